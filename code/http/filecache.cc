@@ -0,0 +1,249 @@
+#include "filecache.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../log/log.h"
+
+using namespace std;
+
+CachedFile::~CachedFile() {
+    if (data) munmap(data, size);
+    if (fd >= 0) close(fd);
+    for (auto& header : headers_) {
+        delete header.load(memory_order_relaxed);
+    }
+}
+
+shared_ptr<const CachedFile> CachedFile::FromContent(string_view content) {
+    auto file = make_shared<CachedFile>();
+    file->size = content.size();
+    file->st.st_size = content.size();
+    if (content.empty()) return file;
+    void* data = mmap(nullptr, content.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        Log_Error("mmap error: %d", errno);
+        return nullptr;
+    }
+    memcpy(data, content.data(), content.size());
+    mprotect(data, content.size(), PROT_READ);
+    file->data = static_cast<char*>(data);
+    return file;
+}
+
+const string* CachedFile::header(int variant) const {
+    assert(variant >= 0 && variant < HEADER_VARIANTS);
+    return headers_[variant].load(memory_order_acquire);
+}
+
+const string* CachedFile::setHeader(int variant, string header) const {
+    assert(variant >= 0 && variant < HEADER_VARIANTS);
+    const string* created = new string(move(header));
+    const string* expected = nullptr;
+    if (!headers_[variant].compare_exchange_strong(expected, created, memory_order_acq_rel)) {
+        delete created;
+        return expected;
+    }
+    return created;
+}
+
+FileCache::FileCache(): capacity_(DEFAULT_CAPACITY), sendfileThreshold_(DEFAULT_SENDFILE_THRESHOLD),
+                        hits_(0), misses_(0), evictions_(0) {
+}
+
+FileCache* FileCache::Instance() {
+    static FileCache cache;
+    return &cache;
+}
+
+FileCache::Shard& FileCache::shard_(const string& path) {
+    return shards_[hash<string>()(path) % SHARDS];
+}
+
+// 文件没有变化: 还是同一个 inode, 大小和修改时间都相同
+static bool SameFile(const struct stat& a, const struct stat& b) {
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size
+        && a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+FileRef FileCache::get(const string& path, int* err, bool cacheMissing) {
+    Shard& shard = shard_(path);
+    Clock::time_point now = Clock::now();
+    FileRef cached;
+    {
+        lock_guard<mutex> locker(shard.mtx);
+        auto it = shard.index.find(path);
+        if (it != shard.index.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            Entry& entry = *it->second;
+            if (now - entry.checked < chrono::milliseconds(REVALIDATE_MS)) {
+                hits_++;
+                if (!entry.file && err) *err = entry.err;
+                return entry.file;
+            }
+            cached = entry.file;
+        }
+    }
+
+    // 系统调用都在锁外做
+    struct stat st;
+    int error = Stat_(path, &st);
+    if (!error && cached && SameFile(cached->st, st)) {
+        lock_guard<mutex> locker(shard.mtx);
+        auto it = shard.index.find(path);
+        if (it != shard.index.end() && it->second->file == cached) {
+            it->second->checked = now;
+        }
+        hits_++;
+        return cached;
+    }
+    misses_++;
+    FileRef file;
+    if (!error) {
+        file = Load_(path, sendfileThreshold_, &error);
+    }
+    if (!file && err) *err = error;
+
+    lock_guard<mutex> locker(shard.mtx);
+    if (file || cacheMissing) {
+        insert_(shard, path, file, error, now);
+    } else {
+        // 文件已经不能访问了, 从缓存中去掉
+        auto it = shard.index.find(path);
+        if (it != shard.index.end()) {
+            erase_(shard, it->second);
+        }
+    }
+    return file;
+}
+
+bool FileCache::statFile(const string& path, struct stat* st, int* err, bool cacheMissing) {
+    assert(st);
+    Shard& shard = shard_(path);
+    Clock::time_point now = Clock::now();
+    {
+        lock_guard<mutex> locker(shard.mtx);
+        auto it = shard.index.find(path);
+        if (it != shard.index.end() && now - it->second->checked < chrono::milliseconds(REVALIDATE_MS)) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            Entry& entry = *it->second;
+            hits_++;
+            if (entry.file) {
+                *st = entry.file->st;
+                return true;
+            }
+            if (err) *err = entry.err;
+            return false;
+        }
+    }
+    misses_++;
+    int error = Stat_(path, st);
+    if (!error) return true;
+    if (err) *err = error;
+    if (cacheMissing) {
+        lock_guard<mutex> locker(shard.mtx);
+        insert_(shard, path, nullptr, error, now);
+    }
+    return false;
+}
+
+int FileCache::Stat_(const string& path, struct stat* st) {
+    if (stat(path.data(), st) < 0 || !S_ISREG(st->st_mode)) {
+        return ENOENT;
+    }
+    if (!(st->st_mode & S_IROTH)) {
+        return EACCES;
+    }
+    return 0;
+}
+
+FileRef FileCache::Load_(const string& path, size_t sendfileThreshold, int* err) {
+    int fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (err) *err = errno;
+        Log_Error("file open error: %s", path.data());
+        return nullptr;
+    }
+    auto file = make_shared<CachedFile>();
+    file->fd = fd;
+    // 用打开后的 fd 重新取一次, 防止 stat 和 open 之间文件被替换
+    if (fstat(fd, &file->st) < 0 || !S_ISREG(file->st.st_mode)) {
+        if (err) *err = ENOENT;
+        return nullptr;
+    }
+    file->size = file->st.st_size;
+    if (file->size > 0 && file->size < sendfileThreshold) {
+        void* data = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            if (err) *err = errno;
+            Log_Error("file mmap error: %s", path.data());
+            return nullptr;
+        }
+        file->data = static_cast<char*>(data);
+    }
+    return file;
+}
+
+void FileCache::insert_(Shard& shard, const string& path, const FileRef& file, int err, Clock::time_point now) {
+    auto it = shard.index.find(path);
+    if (it != shard.index.end()) {
+        erase_(shard, it->second);
+    }
+    if (Cost_(file) > capacity_ / SHARDS) {
+        // 太大的文件不缓存, 只给这一次请求使用
+        return;
+    }
+    shard.lru.push_front(Entry{path, file, err, now});
+    shard.index[path] = shard.lru.begin();
+    shard.bytes += Cost_(file);
+    shrink_(shard);
+}
+
+void FileCache::erase_(Shard& shard, list<Entry>::iterator it) {
+    shard.bytes -= Cost_(it->file);
+    shard.index.erase(it->path);
+    shard.lru.erase(it);
+}
+
+void FileCache::shrink_(Shard& shard) {
+    size_t limit = capacity_ / SHARDS;
+    while (!shard.lru.empty() && (shard.bytes > limit || shard.lru.size() > MAX_FILES_PER_SHARD)) {
+        erase_(shard, prev(shard.lru.end()));
+        evictions_++;
+    }
+}
+
+void FileCache::setCapacity(size_t bytes) {
+    capacity_ = bytes;
+    for (Shard& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        shrink_(shard);
+    }
+}
+
+void FileCache::setSendfileThreshold(size_t bytes) {
+    // 已经缓存的文件保持原样, 直到被淘汰或者文件变化
+    sendfileThreshold_ = bytes;
+}
+
+void FileCache::clear() {
+    for (Shard& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        shard.lru.clear();
+        shard.index.clear();
+        shard.bytes = 0;
+    }
+}
+
+FileCache::Stats FileCache::getStats() {
+    Stats stats = { hits_, misses_, evictions_, 0, 0 };
+    for (Shard& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        stats.files += shard.lru.size();
+        stats.bytes += shard.bytes;
+    }
+    return stats;
+}
@@ -0,0 +1,139 @@
+#ifndef _FILECACHE_H_
+#define _FILECACHE_H_
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <sys/stat.h>
+
+// 一个已打开并映射好的静态文件, 只读, 可以在多个线程、多个响应之间共享
+// 最后一个引用释放时才 munmap/close, 所以从缓存中淘汰后正在发送的响应不受影响
+struct CachedFile {
+    CachedFile() = default;
+    ~CachedFile();
+
+    CachedFile(const CachedFile&) = delete;
+    CachedFile& operator=(const CachedFile&) = delete;
+
+    // 把 content 拷贝到一块只读的匿名映射里, 不对应磁盘上的文件, fd 为 -1; 失败返回 nullptr
+    static std::shared_ptr<const CachedFile> FromContent(std::string_view content);
+
+    // 预先生成的响应头, 由使用者按自己的组合编号, 第一次用到时生成; 文件变化后是新的 CachedFile, 不会过期
+    static const int HEADER_VARIANTS = 8;
+
+    // 还没有生成时返回 nullptr
+    const std::string* header(int variant) const;
+
+    // 放入生成好的响应头并返回; 其它线程已经先放入时丢弃这一份, 返回已有的
+    const std::string* setHeader(int variant, std::string header) const;
+
+    int fd = -1;
+    // 空文件, 以及不小于 sendfile 阈值的大文件为 nullptr, 后者直接用 fd 发送
+    char* data = nullptr;
+    size_t size = 0;
+    struct stat st = {};
+
+private:
+    mutable std::atomic<const std::string*> headers_[HEADER_VARIANTS] = {};
+};
+
+using FileRef = std::shared_ptr<const CachedFile>;
+
+// 进程内共享的静态文件缓存, 按路径缓存打开的 fd 和 mmap
+// 按路径哈希分成若干分片, 每个分片一把锁、一条 LRU 链表, 总字节数和文件数都有上限
+// 命中且距离上次检查不到 REVALIDATE_MS 时不做任何系统调用, 否则用 stat 检查文件是否变化
+class FileCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t files;
+        size_t bytes;
+    };
+
+    static FileCache* Instance();
+
+    // 获取 path 对应的文件, 失败返回 nullptr, err 为 ENOENT(不存在或不是普通文件)、EACCES(其他人不可读) 或其它 errno
+    // cacheMissing 为 true 时失败的结果也缓存一个检查间隔, 用于 .gz 这类大多不存在、又每次都要查的路径;
+    // 客户端给出的任意路径不要用, 以免把正常文件挤出缓存
+    FileRef get(const std::string& path, int* err = nullptr, bool cacheMissing = false);
+
+    // 只取文件信息: 缓存里有没过期的结果时不做系统调用, 否则 stat 一次, 成功的结果不放入缓存
+    // 用在可能根本不需要文件内容的地方, 比如 304
+    bool statFile(const std::string& path, struct stat* st, int* err = nullptr, bool cacheMissing = false);
+
+    // 缓存的总字节数上限, 超过单个分片容量的文件不进缓存, 每次单独映射
+    void setCapacity(size_t bytes);
+
+    size_t capacity() const { return capacity_; }
+
+    // 不小于这个大小的文件只打开不映射, 由连接用 sendfile 发送, 不占用缓存的字节数
+    void setSendfileThreshold(size_t bytes);
+
+    size_t sendfileThreshold() const { return sendfileThreshold_; }
+
+    // 清空缓存, 已经拿到的 FileRef 仍然有效
+    void clear();
+
+    Stats getStats();
+
+    static const size_t DEFAULT_CAPACITY = 64 << 20;
+    static const size_t DEFAULT_SENDFILE_THRESHOLD = 256 << 10;
+    static constexpr int REVALIDATE_MS = 1000;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static const int SHARDS = 16;
+    static const size_t MAX_FILES_PER_SHARD = 256;
+
+    struct Entry {
+        std::string path;
+        // 为 nullptr 时是缓存的失败结果, 错误码在 err
+        FileRef file;
+        int err;
+        Clock::time_point checked;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        // 表头是最近使用的
+        std::list<Entry> lru;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+    };
+
+    FileCache();
+    ~FileCache() = default;
+
+    // 和 stat 一样, 另外要求是其他人可读的普通文件, 失败返回 ENOENT 或 EACCES
+    static int Stat_(const std::string& path, struct stat* st);
+
+    static FileRef Load_(const std::string& path, size_t sendfileThreshold, int* err);
+
+    // 占用的缓存字节数, 只算映射的部分
+    static size_t Cost_(const FileRef& file) { return file && file->data ? file->size : 0; }
+
+    // 需要持有 shard.mtx
+    void insert_(Shard& shard, const std::string& path, const FileRef& file, int err, Clock::time_point now);
+    void erase_(Shard& shard, std::list<Entry>::iterator it);
+    void shrink_(Shard& shard);
+
+    Shard& shard_(const std::string& path);
+
+    Shard shards_[SHARDS];
+    std::atomic<size_t> capacity_;
+    std::atomic<size_t> sendfileThreshold_;
+
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> evictions_;
+};
+
+#endif
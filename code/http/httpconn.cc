@@ -1,4 +1,5 @@
 #include "httpconn.h"
+#include <limits.h>
 
 using namespace std;
 
@@ -8,8 +9,15 @@ atomic<int> HttpConn::userCount;
 
 HttpConn::HttpConn() {
     fd_ = -1;
+    generation_ = 0;
     addr_ = {0};
     isClose_ = true;
+    iovIdx_ = iovCnt_ = 0;
+    toWrite_ = 0;
+    responseCnt_ = 0;
+    keepAlive_ = false;
+    pending_ = false;
+    httpCode_ = HttpRequest::NO_REQUEST;
 }
 
 HttpConn::~HttpConn() {
@@ -22,26 +30,49 @@ void HttpConn::init(int sockFd, const sockaddr_in& addr) {
     userCount++;
     addr_ = addr;
     fd_ = sockFd;
+    generation_++;
     writeBuff_.retrieveAll();
     readBuff_.retrieveAll();
+    request_.init();
+    iov_.clear();
+    chunks_.clear();
+    iovIdx_ = iovCnt_ = 0;
+    toWrite_ = 0;
+    responseCnt_ = 0;
+    keepAlive_ = false;
+    pending_ = false;
     isClose_ = false;
     Log_Info("Client[%d](%s:%d) in, userCount:%d", fd_, getIp().c_str(), getPort(), (int)userCount);
 }
 
 void HttpConn::close() {
-    response_.unmapFile();
-    if (isClose_ == false) {
-        isClose_ = true;
-        ::close(fd_);
-        userCount--;
-        Log_Info("Client[%d](%s:%d) quit, UserCount:%d", fd_, getIp().c_str(), getPort(), (int)userCount);
+    int fd = detach();
+    if (fd >= 0) {
+        ::close(fd);
     }
 }
 
+int HttpConn::detach() {
+    for (HttpResponse& response : response_) {
+        response.unmapFile();
+    }
+    if (isClose_) return -1;
+    isClose_ = true;
+    // 关闭后仍持有旧 generation 的任务直接失效, 不必等到槽位被复用
+    generation_++;
+    userCount--;
+    Log_Info("Client[%d](%s:%d) quit, UserCount:%d", fd_, getIp().c_str(), getPort(), (int)userCount);
+    return fd_;
+}
+
 int HttpConn::getFd() const {
     return fd_;
 }
 
+uint32_t HttpConn::getGeneration() const {
+    return generation_;
+}
+
 int HttpConn::getPort() const {
     return addr_.sin_port;
 }
@@ -68,67 +99,199 @@ ssize_t HttpConn::read(int* saveErrno) {
 ssize_t HttpConn::write(int* saveErrno) {
     ssize_t len = -1;
     do {
-        len = writev(fd_, iov_, iovCnt_);
+        if (iovIdx_ < iovCnt_ && isSendfile_(iovIdx_)) {
+            // 大文件直接从缓存的 fd 发送, 偏移由 hasSent 推进
+            const Chunk& chunk = chunks_[iovIdx_];
+            off_t offset = chunk.offset;
+            len = sendfile(fd_, chunk.fd, &offset, iov_[iovIdx_].iov_len);
+        } else {
+            len = writev(fd_, iov_.data() + iovIdx_, writevEnd_() - iovIdx_);
+        }
         if(len <= 0) {
             *saveErrno = errno;
             break;
         }
-        if(static_cast<size_t>(len) > iov_[0].iov_len) {
-            iov_[1].iov_base = (uint8_t*) iov_[1].iov_base + (len - iov_[0].iov_len);
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            if(iov_[0].iov_len) {
-                writeBuff_.retrieveAll();
-                iov_[0].iov_len = 0;
-            }
-        }
-        else {
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len; 
-            iov_[0].iov_len -= len; 
-            writeBuff_.retrieve(len);
-        }
+        hasSent(len);
     } while (isET || toWriteBytes() > 10240 || toWriteBytes() == 0);
     return len;
 }
 
+char* HttpConn::beginRecv(size_t* len) {
+    assert(len);
+    // 没有 readFd 那样的栈上溢出缓冲, 至少留出 4K, 不够就分多次收
+    readBuff_.ensureWritable(4096);
+    *len = readBuff_.writableBytes();
+    return readBuff_.beginWrite();
+}
+
+void HttpConn::hasRecv(size_t len) {
+    readBuff_.hasWritten(len);
+}
+
+void HttpConn::appendRecv(const char* data, size_t len) {
+    readBuff_.append(data, len);
+}
+
+size_t HttpConn::readBytes() const {
+    return readBuff_.readableBytes();
+}
+
+const iovec* HttpConn::writeIov(int* iovCnt) const {
+    assert(iovCnt);
+    assert(iovIdx_ >= iovCnt_ || !isSendfile_(iovIdx_));
+    *iovCnt = writevEnd_() - iovIdx_;
+    return iov_.data() + iovIdx_;
+}
+
+void HttpConn::addIov_(const char* base, size_t len, bool buffered) {
+    if (len == 0) return;
+    if (buffered && iovCnt_ > 0 && chunks_.back().buffered
+        && (const char*)iov_.back().iov_base + iov_.back().iov_len == base) {
+        iov_.back().iov_len += len;
+    } else {
+        iov_.push_back({ const_cast<char*>(base), len });
+        chunks_.push_back({ buffered, -1, 0 });
+        iovCnt_++;
+    }
+    toWrite_ += len;
+}
+
+void HttpConn::addSendfile_(int fd, off_t offset, size_t len) {
+    if (len == 0) return;
+    iov_.push_back({ nullptr, len });
+    chunks_.push_back({ false, fd, offset });
+    iovCnt_++;
+    toWrite_ += len;
+}
+
+bool HttpConn::isSendfile_(int idx) const {
+    return chunks_[idx].fd >= 0;
+}
+
+int HttpConn::writevEnd_() const {
+    int end = iovIdx_;
+    while (end < iovCnt_ && end - iovIdx_ < IOV_MAX && !isSendfile_(end)) end++;
+    return end;
+}
+
+void HttpConn::hasSent(size_t len) {
+    assert(len <= toWrite_);
+    toWrite_ -= len;
+    while (iovIdx_ < iovCnt_) {
+        iovec& iov = iov_[iovIdx_];
+        size_t n = min(len, iov.iov_len);
+        if (iov.iov_base) {
+            iov.iov_base = (uint8_t*)iov.iov_base + n;
+        }
+        iov.iov_len -= n;
+        len -= n;
+        Chunk& chunk = chunks_[iovIdx_];
+        if (chunk.buffered) {
+            // 响应头在 writeBuff_ 里连续存放, 按顺序回收
+            writeBuff_.retrieve(n);
+        } else if (chunk.fd >= 0) {
+            chunk.offset += n;
+        }
+        if (iov.iov_len > 0) break;
+        iovIdx_++;
+    }
+}
+
 bool HttpConn::process() {
-    request_.init();
-    if (readBuff_.readableBytes() <= 0) return false;
-    HttpRequest::HTTP_CODE httpCode = request_.parse(readBuff_);
-    switch (httpCode) {
-    case HttpRequest::HTTP_CODE::NO_REQUEST:
-        return false;
-    case HttpRequest::HTTP_CODE::GET_REQUEST:
-        Log_Debug("process response with path; %s", request_.path().c_str());
-        response_.init(srcDir, request_.path(), request_.isKeepAlive(), 200);
-        break;
-    case HttpRequest::HTTP_CODE::BAD_REQUEST:
-        response_.init(srcDir, request_.path(), false, 400);
-        break;
-    default:
-        Log_Error("Error in handle http_code %d", httpCode);
+    // request_ 在多次读入之间保留解析进度, 上一个请求解析完后 parse 会自动重新开始
+    assert(toWrite_ == 0);
+    if (responseCnt_ > 0) {
+        // 上一批已经写完, 释放它们的文件映射
+        for (int i = 0; i < responseCnt_; i++) {
+            response_[i].unmapFile();
+        }
+        responseCnt_ = 0;
+        writeBuff_.retrieveAll();
     }
-    response_.makeResponse(writeBuff_);
-    /* 响应头 */
-    iov_[0].iov_base = const_cast<char*>(writeBuff_.peek());
-    iov_[0].iov_len = writeBuff_.readableBytes();
-    iovCnt_ = 1;
-
-    /* 文件 */
-    if(response_.file() && response_.fileLen() > 0) {
-        iov_[1].iov_base = response_.file();
-        iov_[1].iov_len = response_.fileLen();
-        iovCnt_ = 2;
+
+    while (responseCnt_ < MAX_PIPELINE && (pending_ || readBuff_.readableBytes() > 0)) {
+        if (!pending_) {
+            httpCode_ = request_.parse(readBuff_);
+            if (httpCode_ == HttpRequest::HTTP_CODE::NO_REQUEST) break;
+            pending_ = true;
+        }
+        if (httpCode_ == HttpRequest::HTTP_CODE::GET_REQUEST && request_.needsVerify()) {
+            // 要等数据库的结果, 先把前面的响应发出去; 后面的请求留在 readBuff_ 里, 保持顺序
+            break;
+        }
+        pending_ = false;
+        HttpResponse& response = response_[responseCnt_];
+        switch (httpCode_) {
+        case HttpRequest::HTTP_CODE::GET_REQUEST:
+            Log_Debug("process response with path; %.*s", (int)request_.path().size(), request_.path().data());
+            keepAlive_ = request_.isKeepAlive();
+            response.init(srcDir, request_.path(), keepAlive_, request_.isMethodAllowed() ? 200 : 405);
+            break;
+        case HttpRequest::HTTP_CODE::BAD_REQUEST:
+            keepAlive_ = false;
+            response.init(srcDir, request_.path(), false, 400);
+            break;
+        default:
+            Log_Error("Error in handle http_code %d", httpCode_);
+            keepAlive_ = false;
+            response.init(srcDir, request_.path(), false, 400);
+        }
+        response.makeResponse(writeBuff_, &request_);
+        responseCnt_++;
+        // 这个响应之后连接就关闭, 后面的请求不再处理
+        if (!keepAlive_) break;
+    }
+    if (responseCnt_ == 0) return false;
+
+    // 所有响应头都追加完再取地址, 追加过程中 writeBuff_ 可能扩容
+    const char* text = writeBuff_.peek();
+    iov_.clear();
+    chunks_.clear();
+    iovIdx_ = iovCnt_ = 0;
+    toWrite_ = 0;
+    for (int i = 0; i < responseCnt_; i++) {
+        const HttpResponse& response = response_[i];
+        for (const HttpResponse::Part& part : response.parts()) {
+            /* 响应头或分段头 */
+            addIov_(text, part.textLen, true);
+            text += part.textLen;
+            /* 文件中要发送的一段 */
+            if (response.file()) {
+                // 直接指向缓存中映射的那一段
+                addIov_(response.file() + part.offset, part.len, false);
+            } else {
+                // 没有映射的大文件由 sendfile 从对应偏移发送
+                addSendfile_(response.fileFd(), part.offset, part.len);
+            }
+        }
     }
-    Log_Debug("filesize:%d, %d  to %d", response_.fileLen() , iovCnt_, toWriteBytes());
+    assert(text == writeBuff_.peek() + writeBuff_.readableBytes());
+    Log_Debug("responses:%d, iovCnt:%d to %zu", responseCnt_, iovCnt_, toWriteBytes());
     return true;
 }
 
-int HttpConn::toWriteBytes() const {
-    return iov_[0].iov_len + iov_[1].iov_len;
+bool HttpConn::waitingVerify() const {
+    return !isClose_ && pending_ && request_.needsVerify() && toWrite_ == 0;
+}
+
+bool HttpConn::idle() const {
+    HttpRequest::PARSE_STATE state = request_.getMainState();
+    return (state == HttpRequest::REQUEST_LINE || state == HttpRequest::FINISH) && !pending_
+        && readBuff_.readableBytes() == 0 && toWrite_ == 0;
+}
+
+void HttpConn::verifyDone(bool ok) {
+    assert(waitingVerify());
+    request_.setVerified(ok);
+}
+
+size_t HttpConn::toWriteBytes() const {
+    return toWrite_;
 }
 
 bool HttpConn::isKeepAlive() const {
-    return request_.isKeepAlive();
+    // request_ 可能已经开始解析下一个请求, 以排队的最后一个响应为准
+    return keepAlive_;
 }
 
 
@@ -3,12 +3,16 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>     // readv/writev
+#include <sys/sendfile.h>
 #include <arpa/inet.h>   // sockaddr_in
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
 #include <string>
+#include <vector>
+#include <atomic>
 
 #include "../log/log.h"
+#include "../timer/timerhook.h"
 #include "httprequest.h"
 #include "httpresponse.h"
 
@@ -27,20 +31,62 @@ public:
 
     void close();
 
+    // 标记连接关闭但不关闭 fd, 返回需要由调用方关闭的 fd, 已关闭时返回 -1
+    int detach();
+
     int getFd() const;
 
+    // 超时计时器节点, 由 Reactor 的 TimeWheel 串起来
+    TimerHook* timer() { return &timer_; }
+
+    // 每次 init 和关闭时递增, 用来区分复用了同一个 fd 的前后两个连接, 以及已经关闭的连接
+    uint32_t getGeneration() const;
+
+    bool isClosed() const { return isClose_; }
+
     int getPort() const;
 
     std::string getIp() const;
 
     sockaddr_in getAddr() const;
 
+    // 解析 readBuff_ 中所有完整的请求, 响应按顺序排进同一批 iovec
+    // 有响应要写时返回 true
     bool process();
 
-    int toWriteBytes() const;
+    size_t toWriteBytes() const;
+
+    // process 停在了一个要查数据库的请求上(前面的响应都已经发完), 由调用方交给 SQL 线程池
+    bool waitingVerify() const;
+
+    // 等待验证的请求, 只读, 用来取出用户名和密码
+    const HttpRequest& request() const { return request_; }
+
+    // 数据库验证完成, 之后再调用 process 生成这个请求的响应
+    void verifyDone(bool ok);
 
     bool isKeepAlive() const;
 
+    // 没有处理到一半的请求: 已读入的请求都处理完了, 响应也发完了, 下一个字节是新请求的开始
+    bool idle() const;
+
+    // io_uring 后端使用: 内核直接把数据收进 readBuff_, 完成后登记长度
+    char* beginRecv(size_t* len);
+
+    void hasRecv(size_t len);
+
+    // io_uring 多路 recv 使用: 数据在内核选的缓冲区里, 复制进 readBuff_
+    void appendRecv(const char* data, size_t len);
+
+    // readBuff_ 里还没处理的字节数
+    size_t readBytes() const;
+
+    // io_uring 后端使用: 待发送的 iovec, 发送完成后用 hasSent 推进
+    // 遇到需要 sendfile 的文件时只返回它之前的部分, io_uring 后端不使用 sendfile
+    const iovec* writeIov(int* iovCnt) const;
+
+    void hasSent(size_t len);
+
 
     static bool isET;
 
@@ -48,20 +94,62 @@ public:
 
     static std::atomic<int> userCount;
 
+    // 一批最多排队的流水线响应数, 多出来的请求留在 readBuff_ 里, 这一批写完后再处理
+    static const int MAX_PIPELINE = 16;
+
 private:
+    // iov_ 中每一项的来源
+    struct Chunk {
+        // 指向 writeBuff_, 发送后要回收
+        bool buffered;
+        // 用 sendfile 发送时是文件 fd, 否则为 -1
+        int fd;
+        // sendfile 下一次发送的文件偏移
+        off_t offset;
+    };
+
+    // 追加一段内存, 和前一段在 writeBuff_ 里相连时合并
+    void addIov_(const char* base, size_t len, bool buffered);
+
+    // 追加一段用 sendfile 发送的文件
+    void addSendfile_(int fd, off_t offset, size_t len);
+
+    // 第 idx 个 iovec 是否是用 sendfile 发送的文件
+    bool isSendfile_(int idx) const;
+
+    // 从 iovIdx_ 开始可以一次 writev 的 iovec 的结尾
+    int writevEnd_() const;
+
     int fd_;
+    // 工作线程里的任务按它判断连接是否已经被复用
+    std::atomic<uint32_t> generation_;
     sockaddr_in addr_;
 
-    bool isClose_;
+    // 关闭可能发生在工作线程, 与 Reactor 线程的查找并发
+    std::atomic<bool> isClose_;
 
+    // 一批响应按发送顺序排成的 iovec, 响应头和分段头指向 writeBuff_, 文件内容指向缓存的映射
+    // 文件没有映射时 iov_base 为 nullptr, iov_len 是剩余长度, 改用 sendfile 发送
+    // 两个数组下标一一对应, 只在 process 中增长, clear 后保留容量
+    int iovIdx_;
     int iovCnt_;
-    iovec iov_[2];
+    std::vector<iovec> iov_;
+    std::vector<Chunk> chunks_;
+    size_t toWrite_;
 
     Buffer readBuff_;
     Buffer writeBuff_;
 
     HttpRequest request_;
-    HttpResponse response_;    
+    // request_ 已经解析出一个请求, 还没有生成响应
+    bool pending_;
+    HttpRequest::HTTP_CODE httpCode_;
+    HttpResponse response_[MAX_PIPELINE];
+    int responseCnt_;
+    // 最后一个排队的响应是否保持连接
+    bool keepAlive_;
+
+    TimerHook timer_;    
 
 };
 
@@ -0,0 +1,156 @@
+#include "httpheader.h"
+#include <assert.h>
+#include <algorithm>
+
+using namespace std;
+
+namespace HttpHeader {
+
+static const string_view NAMES[FIELD_COUNT] = {
+    "Content-Length",
+    "Content-Type",
+    "Host",
+    "Connection",
+    "Accept-Encoding",
+    "If-None-Match",
+    "If-Modified-Since",
+    "Range",
+    "If-Range",
+};
+
+string_view Name(Field field) {
+    assert(field >= 0 && field < FIELD_COUNT);
+    return NAMES[field];
+}
+
+bool EqualsIgnoreCase(string_view a, string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        // 首部名称只会是 ASCII, 按位或 0x20 就能统一大小写; 非字母的位置要求完全相同
+        char x = a[i], y = b[i];
+        if (x != y && ((x | 0x20) != (y | 0x20) || static_cast<unsigned char>((x | 0x20) - 'a') >= 26)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NextListItem(string_view& list, string_view* item) {
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        string_view raw = list.substr(0, comma);
+        list = (comma == string_view::npos) ? string_view() : list.substr(comma + 1);
+        size_t begin = raw.find_first_not_of(" \t");
+        if (begin == string_view::npos) continue;
+        size_t end = raw.find_last_not_of(" \t");
+        *item = raw.substr(begin, end - begin + 1);
+        return true;
+    }
+    return false;
+}
+
+static const char* DATE_FORMAT = "%a, %d %b %Y %H:%M:%S GMT";
+
+size_t FormatDate(time_t t, char* buf) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return strftime(buf, DATE_LEN + 1, DATE_FORMAT, &tm);
+}
+
+bool ParseDate(string_view value, time_t* t) {
+    if (value.size() != DATE_LEN) return false;
+    char buf[DATE_LEN + 1];
+    value.copy(buf, DATE_LEN);
+    buf[DATE_LEN] = '\0';
+    struct tm tm = {};
+    const char* end = strptime(buf, DATE_FORMAT, &tm);
+    if (!end || *end != '\0') return false;
+    *t = timegm(&tm);
+    return true;
+}
+
+string_view CurrentDate() {
+    thread_local time_t last = -1;
+    thread_local char buf[DATE_LEN + 1];
+    time_t now = time(nullptr);
+    if (now != last) {
+        FormatDate(now, buf);
+        last = now;
+    }
+    return string_view(buf, DATE_LEN);
+}
+
+Field Lookup(string_view name) {
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        // 先比长度, 绝大多数情况下不用逐字节比较
+        if (NAMES[i].size() == name.size() && EqualsIgnoreCase(NAMES[i], name)) {
+            return static_cast<Field>(i);
+        }
+    }
+    return UNKNOWN;
+}
+
+}
+
+HeaderTable::HeaderTable() {
+    clear();
+}
+
+void HeaderTable::clear() {
+    size_ = 0;
+    overflow_.clear();
+    fill(begin(known_), end(known_), -1);
+    raw_.clear();
+}
+
+void HeaderTable::add(string_view name, string_view value) {
+    Entry entry;
+    entry.nameOffset = raw_.size();
+    entry.nameLen = name.size();
+    raw_.append(name);
+    entry.valueOffset = raw_.size();
+    entry.valueLen = value.size();
+    raw_.append(value);
+    if (size_ < INLINE_CAPACITY) {
+        inline_[size_] = entry;
+    } else {
+        overflow_.push_back(entry);
+    }
+    HttpHeader::Field field = HttpHeader::Lookup(name);
+    if (field != HttpHeader::UNKNOWN) {
+        known_[field] = size_;
+    }
+    size_++;
+}
+
+const HeaderTable::Entry& HeaderTable::entry_(size_t i) const {
+    assert(i < size_);
+    return i < INLINE_CAPACITY ? inline_[i] : overflow_[i - INLINE_CAPACITY];
+}
+
+string_view HeaderTable::get(HttpHeader::Field field) const {
+    assert(field >= 0 && field < HttpHeader::FIELD_COUNT);
+    if (known_[field] < 0) return string_view();
+    return value(known_[field]);
+}
+
+string_view HeaderTable::get(string_view name) const {
+    HttpHeader::Field field = HttpHeader::Lookup(name);
+    if (field != HttpHeader::UNKNOWN) return get(field);
+    for (size_t i = size_; i > 0; i--) {
+        if (HttpHeader::EqualsIgnoreCase(this->name(i - 1), name)) {
+            return value(i - 1);
+        }
+    }
+    return string_view();
+}
+
+string_view HeaderTable::name(size_t i) const {
+    const Entry& entry = entry_(i);
+    return slice_(entry.nameOffset, entry.nameLen);
+}
+
+string_view HeaderTable::value(size_t i) const {
+    const Entry& entry = entry_(i);
+    return slice_(entry.valueOffset, entry.valueLen);
+}
@@ -2,15 +2,106 @@
 #define _HTTPHEADER_H_
 
 #include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
 
 
 namespace HttpHeader {
-static const std::string content_length = "Content-Length";
-static const std::string content_type = "Content-Type";
-static const std::string host = "Host";
-static const std::string connection = "Connection";
+
+// 预先编号的常用首部, 解析时识别一次, 之后按下标直接取
+enum Field {
+    CONTENT_LENGTH = 0,
+    CONTENT_TYPE,
+    HOST,
+    CONNECTION,
+    ACCEPT_ENCODING,
+    IF_NONE_MATCH,
+    IF_MODIFIED_SINCE,
+    RANGE,
+    IF_RANGE,
+    FIELD_COUNT,
+    // 不在上面列表里的首部
+    UNKNOWN = FIELD_COUNT,
+};
+
+// 首部名称的标准写法
+std::string_view Name(Field field);
+
+// 不区分大小写地识别首部名称, 不认识的返回 UNKNOWN
+Field Lookup(std::string_view name);
+
+// 不区分大小写比较
+bool EqualsIgnoreCase(std::string_view a, std::string_view b);
+
+// 从逗号分隔的列表中取出下一项并去掉两边空白, list 前移到这一项之后; 列表取完返回 false
+bool NextListItem(std::string_view& list, std::string_view* item);
+
+// HTTP 日期(IMF-fixdate), 例如 "Sun, 06 Nov 1994 08:49:37 GMT"
+static const size_t DATE_LEN = 29;
+
+// 写入 buf, 返回长度, buf 至少 DATE_LEN + 1 字节
+size_t FormatDate(time_t t, char* buf);
+
+// 只接受 IMF-fixdate, 其它格式返回 false
+bool ParseDate(std::string_view value, time_t* t);
+
+// 当前时间, 每个线程每秒只格式化一次; 返回值在本线程下一次调用前有效
+std::string_view CurrentDate();
 
 }
 
+// 一个请求的首部表
+// 名称和值拷贝到内部的一块连续存储里, 表项只记偏移和长度; 存储和表项数组在 clear 后保留容量,
+// 稳定运行时解析首部不再分配内存
+// 不直接指向读缓冲区: 请求被拆成多次读入时, 读缓冲区可能在两次读之间被挪动
+// 同名首部出现多次时, 查询返回最后一个
+class HeaderTable {
+public:
+    static const int INLINE_CAPACITY = 16;
+
+    HeaderTable();
+
+    void clear();
+
+    void add(std::string_view name, std::string_view value);
+
+    // 不存在时返回空的 string_view, 可以用 data() == nullptr 区分空值和不存在
+    std::string_view get(HttpHeader::Field field) const;
+
+    std::string_view get(std::string_view name) const;
+
+    bool has(HttpHeader::Field field) const { return known_[field] >= 0; }
+
+    size_t size() const { return size_; }
+
+    std::string_view name(size_t i) const;
+
+    std::string_view value(size_t i) const;
+
+private:
+    struct Entry {
+        uint32_t nameOffset;
+        uint32_t nameLen;
+        uint32_t valueOffset;
+        uint32_t valueLen;
+    };
+
+    const Entry& entry_(size_t i) const;
+
+    std::string_view slice_(uint32_t offset, uint32_t len) const {
+        return std::string_view(raw_.data() + offset, len);
+    }
+
+    Entry inline_[INLINE_CAPACITY];
+    // 超过 INLINE_CAPACITY 的部分
+    std::vector<Entry> overflow_;
+    size_t size_;
+    // 已知首部在表中的下标, -1 表示没有
+    int known_[HttpHeader::FIELD_COUNT];
+    std::string raw_;
+};
+
 
-#endif
\ No newline at end of file
+#endif
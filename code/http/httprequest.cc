@@ -12,16 +12,22 @@ const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
 void HttpRequest::init() {
     parseState_ = PARSE_STATE::REQUEST_LINE;
     lineState_ = LINE_STATE::LINE_OK;
-    method_ = "";
-    path_ = "";
-    version_ = "";
-    body_ = "";
+    scanned_ = 0;
+    method_.clear();
+    path_.clear();
+    version_.clear();
+    body_.clear();
+    contentLength_ = 0;
+    verifyTag_ = -1;
     header_.clear();
     post_.clear();
 }
 
 HttpRequest::HTTP_CODE HttpRequest::parse(Buffer& buff) {
-    string line;
+    if (parseState_ == FINISH) {
+        init();
+    }
+    string_view line;
     HTTP_CODE ret = HTTP_CODE::NO_REQUEST;
     while (getLine(buff, line) == LINE_OK) {
         switch(parseState_) {
@@ -29,6 +35,7 @@ HttpRequest::HTTP_CODE HttpRequest::parse(Buffer& buff) {
             ret = parseRequestLine_(line);
             buff.retrieve(line.length() + 2);
             if (ret == BAD_REQUEST) {
+                parseState_ = FINISH;
                 return BAD_REQUEST;
             }
             break;
@@ -37,12 +44,14 @@ HttpRequest::HTTP_CODE HttpRequest::parse(Buffer& buff) {
             buff.retrieve(line.length() + 2);
             if (ret != NO_REQUEST) {
                 // GET_REQUEST or BAD_REQUEST
+                parseState_ = FINISH;
                 return ret;
             }
             break;
         case BODY:
             ret = parseBody_(line);
             buff.retrieve(line.length());
+            parseState_ = FINISH;
             return ret;
             break;
         default:
@@ -53,97 +62,152 @@ HttpRequest::HTTP_CODE HttpRequest::parse(Buffer& buff) {
     return NO_REQUEST;
 }
 
-HttpRequest::LINE_STATE HttpRequest::getLine(Buffer& buff, string& line) {
-    static const char CRLF[] = "\r\n";
+HttpRequest::LINE_STATE HttpRequest::getLine(Buffer& buff, string_view& line) {
     if (parseState_ != BODY) {
-        const char* lineEnd = search(buff.peek(), static_cast<const char*>(buff.beginWrite()), CRLF, CRLF + 2);
+        // 上次扫描到的最后一个字节可能是 '\r', 退回一个字节
+        size_t skip = min(scanned_ > 0 ? scanned_ - 1 : 0, buff.readableBytes());
+        const char* lineEnd = HttpScan::FindCrlf(buff.peek() + skip, buff.beginWrite());
         if (lineEnd == buff.beginWrite()) {
             // 没有找到\r\n
-            line = "";
+            line = string_view();
+            scanned_ = buff.readableBytes();
             lineState_ = LINE_STATE::LINE_OPEN;
         } else {
-            line = string(buff.peek(), lineEnd);
+            line = string_view(buff.peek(), lineEnd - buff.peek());
+            scanned_ = 0;
             lineState_ = LINE_STATE::LINE_OK;
         }
     } else {
-        if (header_.count(HttpHeader::content_length) == 0) {
-            lineState_ = LINE_STATE::LINE_ERROR;
+        if (buff.readableBytes() < contentLength_) {
+            line = string_view();
+            lineState_ = LINE_STATE::LINE_OPEN;
         } else {
-            size_t contentLength = stoi(header_[HttpHeader::content_length]);
-            if (buff.readableBytes() < contentLength) {
-                line = "";
-                lineState_ = LINE_STATE::LINE_OPEN;
-            } else {
-                line = string(buff.peek(), buff.peek() + contentLength);
-                lineState_ = LINE_STATE::LINE_OK;
-            }
+            line = string_view(buff.peek(), contentLength_);
+            lineState_ = LINE_STATE::LINE_OK;
         }
     }
     return lineState_;
 }
 
 
-string HttpRequest::getPost(const string& key) const {
-    assert(key != "");
-    if(post_.count(key) == 1) {
-        return post_.find(key)->second;
+string_view HttpRequest::getPost(string_view key) const {
+    assert(!key.empty());
+    // 同名键以最后一个为准
+    for (auto it = post_.rbegin(); it != post_.rend(); ++it) {
+        if (it->first == key) {
+            return it->second;
+        }
     }
-    return "";
+    return string_view();
 }
 
-string HttpRequest::getPost(const char* key) const {
-    assert(key != nullptr);
-    return getPost(string(key));
+bool HttpRequest::isKeepAlive() const {
+    return HttpHeader::EqualsIgnoreCase(header_.get(HttpHeader::CONNECTION), "keep-alive") && version_ == "1.1";
 }
 
-bool HttpRequest::isKeepAlive() const {
-    if(header_.count(HttpHeader::connection) == 1) {
-        return header_.find(HttpHeader::connection)->second == "keep-alive" && version_ == "1.1";
+// Accept-Encoding: gzip, deflate;q=0.5, br;q=0
+bool HttpRequest::acceptsEncoding(string_view coding) const {
+    string_view list = header_.get(HttpHeader::ACCEPT_ENCODING);
+    string_view item;
+    bool wildcard = false;
+    while (HttpHeader::NextListItem(list, &item)) {
+        size_t semi = item.find(';');
+        string_view name = item.substr(0, semi);
+        name = name.substr(0, name.find_last_not_of(" \t") + 1);
+        bool accepted = true;
+        if (semi != string_view::npos) {
+            size_t paramBegin = min(item.find_first_not_of(" \t", semi + 1), item.size());
+            string_view param = item.substr(paramBegin);
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                // 只有 0 和 . 组成的 q 值就是 0
+                accepted = param.find_first_not_of("0.", 2) != string_view::npos;
+            }
+        }
+        if (HttpHeader::EqualsIgnoreCase(name, coding)) return accepted;
+        if (name == "*") wildcard = accepted;
     }
-    return false;
+    return wildcard;
 }
 
-HttpRequest::HTTP_CODE HttpRequest::parseRequestLine_(const string& line) {
-    regex pattern("^([a-zA-Z]+) ([^ ]+) HTTP/([^ ]+)$");
-    smatch subMatch;
-    if(regex_match(line, subMatch, pattern)) {   
-        method_ = subMatch[1];
-        path_ = subMatch[2];
-        version_ = subMatch[3];
-        parsePath_();
-        parseState_ = PARSE_STATE::HEADERS;
-    } else {
-        Log_Error("parseRequestLine Error, line: %s", line.c_str());
+// METHOD SP PATH SP HTTP/VERSION
+// METHOD 只能是字母, PATH 和 VERSION 不能为空也不能含空格, 分隔符只能是一个空格
+HttpRequest::HTTP_CODE HttpRequest::parseRequestLine_(string_view line) {
+    static const string_view HTTP_PREFIX = "HTTP/";
+    size_t n = line.size();
+    size_t i = HttpScan::SkipAlpha(line.data(), line.data() + n) - line.data();
+    size_t methodEnd = i;
+    if (methodEnd == 0 || i >= n || line[i] != ' ') {
+        Log_Error("parseRequestLine Error, line: %.*s", (int)line.size(), line.data());
+        return BAD_REQUEST;
+    }
+    size_t pathBegin = ++i;
+    while (i < n && line[i] != ' ') i++;
+    size_t pathEnd = i;
+    if (pathEnd == pathBegin || i >= n || line.compare(i + 1, HTTP_PREFIX.size(), HTTP_PREFIX) != 0) {
+        Log_Error("parseRequestLine Error, line: %.*s", (int)line.size(), line.data());
+        return BAD_REQUEST;
+    }
+    size_t versionBegin = i + 1 + HTTP_PREFIX.size();
+    string_view version = line.substr(min(versionBegin, n));
+    if (version.empty() || version.find(' ') != string_view::npos) {
+        Log_Error("parseRequestLine Error, line: %.*s", (int)line.size(), line.data());
         return BAD_REQUEST;
     }
+    method_.assign(line.data(), methodEnd);
+    path_.assign(line.data() + pathBegin, pathEnd - pathBegin);
+    version_.assign(version.data(), version.size());
+    parsePath_();
+    parseState_ = PARSE_STATE::HEADERS;
     return NO_REQUEST;
 }
 
-HttpRequest::HTTP_CODE HttpRequest::parseHeader_(const string& line) {
+// KEY: VALUE, 冒号后最多跳过一个空格, VALUE 中不能有单独的 \r 或 \n
+HttpRequest::HTTP_CODE HttpRequest::parseHeader_(string_view line) {
     if (line.empty()) {
-        if (header_.count(HttpHeader::content_length) == 0 || stoi(header_.at(HttpHeader::content_length)) == 0) {
+        string_view length = header_.get(HttpHeader::CONTENT_LENGTH);
+        if (length.data() && !ParseContentLength_(length, &contentLength_)) {
+            Log_Error("parseHeader Error, Content-Length: %.*s", (int)length.size(), length.data());
+            return BAD_REQUEST;
+        }
+        if (contentLength_ == 0) {
             return GET_REQUEST;
         } else {
             parseState_ = PARSE_STATE::BODY;
             return NO_REQUEST;
         }
     }
-    regex patten("^([^:]*): ?(.*)$");
-    smatch subMatch;
-    if(regex_match(line, subMatch, patten)) {
-        header_[subMatch[1]] = subMatch[2];
-    } else {
-        Log_Error("parseHeader Error, line: %s", line.c_str());
+    const char* lineEnd = line.data() + line.size();
+    // 头部名只能由 tchar 组成, 后面紧跟冒号, 中间不能有空白
+    size_t colon = HttpScan::SkipToken(line.data(), lineEnd) - line.data();
+    bool validName = colon > 0 && colon < line.size() && line[colon] == ':';
+    size_t valueBegin = colon + 1;
+    if (validName && valueBegin < line.size() && line[valueBegin] == ' ') {
+        valueBegin++;
+    }
+    if (!validName || HttpScan::FindCrOrLf(line.data() + valueBegin, lineEnd) != lineEnd) {
+        Log_Error("parseHeader Error, line: %.*s", (int)line.size(), line.data());
         return BAD_REQUEST;
     }
+    header_.add(line.substr(0, colon), line.substr(valueBegin));
     return NO_REQUEST;
 }
 
-HttpRequest::HTTP_CODE HttpRequest::parseBody_(const string& line) {
-    body_ = line;
+HttpRequest::HTTP_CODE HttpRequest::parseBody_(string_view line) {
+    body_.assign(line.data(), line.size());
     return parsePost_();
 }
 
+bool HttpRequest::ParseContentLength_(string_view value, size_t* len) {
+    if (value.empty() || value.size() > 18) return false;
+    size_t result = 0;
+    for (char ch : value) {
+        if (ch < '0' || ch > '9') return false;
+        result = result * 10 + (ch - '0');
+    }
+    *len = result;
+    return true;
+}
+
 void HttpRequest::parsePath_() {
     if(path_ == "/") {
         path_ = "/index.html"; 
@@ -161,74 +225,76 @@ void HttpRequest::parsePath_() {
 
 // TODO: read code and modify return value check
 HttpRequest::HTTP_CODE HttpRequest::parsePost_() {
-    if(method_ == "POST" && header_[HttpHeader::content_type] == "application/x-www-form-urlencoded") {
+    if(method_ == "POST" && header_.get(HttpHeader::CONTENT_TYPE) == "application/x-www-form-urlencoded") {
         parseFromUrlencoded_();
         if(DEFAULT_HTML_TAG.count(path_)) {
             int tag = DEFAULT_HTML_TAG.find(path_)->second;
             Log_Debug("Tag:%d", tag);
             if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                } 
-                else {
-                    path_ = "/error.html";
-                }
+                // 由连接交给 SQL 线程池验证, 结果通过 setVerified 填回来
+                verifyTag_ = tag;
             }
         }
     }
     return GET_REQUEST;
 }
 
+void HttpRequest::setVerified(bool ok) {
+    assert(needsVerify());
+    path_ = ok ? "/welcome.html" : "/error.html";
+    verifyTag_ = -1;
+}
+
 // TODO: read
 void HttpRequest::parseFromUrlencoded_() {
     if(body_.size() == 0) { return; }
 
-    int n = body_.size();
-    string processed_body;
-    for (int i = 0; i < n; i++) {
-        if (body_[i] == '+') processed_body += ' ';
-        else if (body_[i] == '%') {
+    // 解码后只会变短, 直接在 body_ 上原地解码
+    size_t n = body_.size(), len = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (body_[i] == '+') body_[len++] = ' ';
+        else if (body_[i] == '%' && i + 2 < n) {
             int num = ConverHex(body_[i + 1]) * 16 + ConverHex(body_[i + 2]);
-            char ch = static_cast<char>(num);
+            body_[len++] = static_cast<char>(num);
             i += 2;
-            processed_body += ch;
         } else {
-            processed_body += body_[i];
+            body_[len++] = body_[i];
         }
     }
-    body_ = std::move(processed_body);
-    string key, value;
-    n = body_.size();
-    int i = 0, j = 0;
-    for(; i < n; i++) {
-        char ch = body_[i];
+    body_.resize(len);
+    // post_ 指向 body_, 之后 body_ 不能再修改
+    string_view body = body_;
+    string_view key, value;
+    size_t i = 0, j = 0;
+    for(; i < len; i++) {
+        char ch = body[i];
         switch (ch) {
         case '=':
-            key = body_.substr(j, i - j);
+            key = body.substr(j, i - j);
             j = i + 1;
             break;
         case '&':
-            value = body_.substr(j, i - j);
+            value = body.substr(j, i - j);
             j = i + 1;
-            post_[key] = value;
-            Log_Debug("%s = %s", key.c_str(), value.c_str());
+            post_.emplace_back(key, value);
+            Log_Debug("%.*s = %.*s", (int)key.size(), key.data(), (int)value.size(), value.data());
             break;
         default:
             break;
         }
     }
     assert(j <= i);
-    if(post_.count(key) == 0 && j < i) {
-        value = body_.substr(j, i - j);
-        post_[key] = value;
+    bool seen = any_of(post_.begin(), post_.end(), [key](const auto& kv) { return kv.first == key; });
+    if(!seen && j < i) {
+        value = body.substr(j, i - j);
+        post_.emplace_back(key, value);
     }
 }
 
 
-bool HttpRequest::UserVerify(const std::string& name, const std::string pwd, bool isLogin) {
-    if(name == "" || pwd == "") { return false; }
-    Log_Info("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
+bool HttpRequest::UserVerify(string_view name, string_view pwd, bool isLogin) {
+    if(name.empty() || pwd.empty()) { return false; }
+    Log_Info("Verify name:%.*s pwd:%.*s", (int)name.size(), name.data(), (int)pwd.size(), pwd.data());
     SqlConnRAII conn(SqlConnPool::Instance());
     assert(conn.get() != nullptr);
     bool flag = false;
@@ -236,7 +302,7 @@ bool HttpRequest::UserVerify(const std::string& name, const std::string pwd, boo
     
     if(!isLogin) { flag = true; }
     /* 查询用户及密码 */
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
+    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%.*s' LIMIT 1", (int)name.size(), name.data());
     Log_Debug("%s", order);
 
     if(mysql_query(conn.get(), order)) { 
@@ -250,7 +316,7 @@ bool HttpRequest::UserVerify(const std::string& name, const std::string pwd, boo
 
     while(MYSQL_ROW row = mysql_fetch_row(res)) {
         Log_Debug("MYSQL ROW: %s %s", row[0], row[1]);
-        string password(row[1]);
+        string_view password(row[1]);
         /* 注册行为 且 用户名未被使用*/
         if(isLogin) {
             if(pwd == password) { flag = true; }
@@ -270,7 +336,7 @@ bool HttpRequest::UserVerify(const std::string& name, const std::string pwd, boo
     if(!isLogin && flag == true) {
         Log_Debug("regirster!");
         bzero(order, 256);
-        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
+        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%.*s','%.*s')", (int)name.size(), name.data(), (int)pwd.size(), pwd.data());
         Log_Debug("%s", order);
         if(mysql_query(conn.get(), order)) { 
             Log_Debug( "Insert error!");
@@ -4,7 +4,9 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
-#include <regex>
+#include <string_view>
+#include <vector>
+#include <algorithm>
 #include <errno.h>     
 #include <mysql/mysql.h>  //mysql
 
@@ -13,6 +15,7 @@
 #include "../pool/sqlconnpool.h"
 #include "../pool/sqlconnRAII.h"
 #include "httpheader.h"
+#include "httpscan.h"
 
 class HttpRequest {
 public:
@@ -20,6 +23,8 @@ public:
         REQUEST_LINE = 0,
         HEADERS,
         BODY,
+        // 一个请求已经解析完, 下一次 parse 会从新请求开始
+        FINISH,
     };
 
     enum LINE_STATE {
@@ -48,45 +53,72 @@ public:
     // 解析读入数据
     // 解析成功返回 GET_REQUEST
     // 解析错误返回 BAD_REQUEST
-    // 解析数据未读入完全返回 NO_REQUEST
+    // 解析数据未读入完全返回 NO_REQUEST, 已解析的部分保留, 读入更多数据后再次调用会接着解析
     HTTP_CODE parse(Buffer& buff);
 
-    std::string path() const { return path_; };
-    std::string method() const { return method_; };
-    std::string version() const { return version_; };
-    std::string body() const { return body_; }
-    std::string getPost(const std::string& key) const;
-    std::string getPost(const char* key) const;
-    PARSE_STATE getMainState() { return parseState_; }
+    // 以下返回的 string_view 指向请求内部, 在下一次 parse/init 前有效
+    std::string_view path() const { return path_; };
+    std::string_view method() const { return method_; };
+    std::string_view version() const { return version_; };
+    std::string_view body() const { return body_; }
+    std::string_view getPost(std::string_view key) const;
+    // 不区分大小写, 不存在时返回空
+    std::string_view getHeader(HttpHeader::Field field) const { return header_.get(field); }
+    std::string_view getHeader(std::string_view name) const { return header_.get(name); }
+    PARSE_STATE getMainState() const { return parseState_; }
     LINE_STATE getSubState() { return lineState_; }
 
     bool isKeepAlive() const;
 
-    LINE_STATE getLine(Buffer& buff, std::string& line);
+    // 登录/注册要查数据库才能决定返回的页面, parse 只把它记下来, 不在解析时阻塞
+    bool needsVerify() const { return verifyTag_ >= 0; }
+    bool isLogin() const { return verifyTag_ == 1; }
+    // 填入数据库验证的结果, 之后 path 是欢迎页或者错误页
+    void setVerified(bool ok);
+
+    // 阻塞查询数据库, 只在专门的 SQL 线程池里调用
+    static bool UserVerify(std::string_view name, std::string_view pwd, bool isLogin);
+
+    // 只支持 GET 和 POST, 其它方法回复 405
+    bool isMethodAllowed() const { return method_ == "GET" || method_ == "POST"; }
+
+    // 按 Accept-Encoding 判断客户端是否接受 coding, q=0 视为不接受, 支持 *
+    bool acceptsEncoding(std::string_view coding) const;
+
+    // line 指向 buff 内部, 不拷贝, 在 buff 下一次写入前有效
+    LINE_STATE getLine(Buffer& buff, std::string_view& line);
 
 private:
-    HTTP_CODE parseRequestLine_(const std::string& line);
-    HTTP_CODE parseHeader_(const std::string& line);
-    HTTP_CODE parseBody_(const std::string& line);
+    HTTP_CODE parseRequestLine_(std::string_view line);
+    HTTP_CODE parseHeader_(std::string_view line);
+    HTTP_CODE parseBody_(std::string_view line);
+
+    // 解析 Content-Length, 非法时返回 false
+    static bool ParseContentLength_(std::string_view value, size_t* len);
 
 
     void parsePath_();
     HTTP_CODE parsePost_();
     void parseFromUrlencoded_();
 
-    static bool UserVerify(const std::string& name, const std::string pwd, bool isLogin);
-
     PARSE_STATE parseState_;
 
     LINE_STATE lineState_;
 
+    // 当前这一行已经扫描过、确定没有 \r\n 的字节数, 数据没读全时下次从这里继续找
+    size_t scanned_;
+
     std::string method_;
     std::string path_;
     std::string version_;
     std::string body_;
+    size_t contentLength_;
+    // DEFAULT_HTML_TAG 中的值, 0 注册, 1 登录; 不需要验证时为 -1
+    int verifyTag_;
 
-    std::unordered_map<std::string, std::string> header_;
-    std::unordered_map<std::string, std::string> post_;
+    HeaderTable header_;
+    // 指向 body_ 中解码后的键值, clear 后保留容量
+    std::vector<std::pair<std::string_view, std::string_view>> post_;
 
     static const std::unordered_set<std::string> DEFAULT_HTML;
     static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG;
@@ -1,4 +1,7 @@
 #include "httpresponse.h"
+#include "httprequest.h"
+#include <random>
+#include <cstring>
 
 using namespace std;
 
@@ -24,67 +27,314 @@ const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
     { ".js",    "text/javascript "},
 };
 
+// 按扩展名的缓存策略: 页面每次都要验证, 静态资源可以直接用一段时间, 过期后再用 ETag 验证
+const unordered_map<string, string> HttpResponse::SUFFIX_CACHE = {
+    { ".html",  "no-cache" },
+    { ".xhtml", "no-cache" },
+    { ".css",   "public, max-age=86400" },
+    { ".js",    "public, max-age=86400" },
+    { ".png",   "public, max-age=604800" },
+    { ".gif",   "public, max-age=604800" },
+    { ".jpg",   "public, max-age=604800" },
+    { ".jpeg",  "public, max-age=604800" },
+    { ".ico",   "public, max-age=604800" },
+    { ".woff",  "public, max-age=604800" },
+    { ".woff2", "public, max-age=604800" },
+    { ".ttf",   "public, max-age=604800" },
+    { ".mpeg",  "public, max-age=604800" },
+    { ".mpg",   "public, max-age=604800" },
+    { ".mp4",   "public, max-age=604800" },
+    { ".avi",   "public, max-age=604800" },
+};
+
 const unordered_map<int, string> HttpResponse::CODE_STATUS = {
     { 200, "OK" },
+    { 206, "Partial Content" },
+    { 304, "Not Modified" },
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 405, "Method Not Allowed" },
+    { 416, "Range Not Satisfiable" },
 };
 
 const unordered_map<int, string> HttpResponse::CODE_PATH = {
     { 400, "/400.html" },
     { 403, "/403.html" },
     { 404, "/404.html" },
+    { 405, "/405.html" },
 };
 
+unordered_map<int, HttpResponse::ErrorPage> HttpResponse::errorPages_;
+once_flag HttpResponse::errorPagesOnce_;
+
 HttpResponse::HttpResponse() {
     code_ = -1;
     path_ = srcDir_ = "";
     isKeepAlive_ = false;
-    mmFile_ = nullptr; 
-    mmFileStat_ = { 0 };
+    gzip_ = vary_ = false;
+    fileStat_ = {};
 }
 
 HttpResponse::~HttpResponse() {
     unmapFile();
 }
 
-void HttpResponse::init(const std::string &srcDir, const std::string& path, bool isKeepAlive, int code) {
+void HttpResponse::init(const std::string &srcDir, std::string_view path, bool isKeepAlive, int code) {
     assert(srcDir != "");
-    if (mmFile_) unmapFile();
+    unmapFile();
     code_ = code;
     isKeepAlive_ = isKeepAlive;
-    path_ = path;
+    gzip_ = vary_ = false;
+    fileStat_ = {};
+    path_.assign(path.data(), path.size());
     srcDir_ = srcDir;
-    mmFile_ = nullptr; 
-    mmFileStat_ = { 0 };
 }
 
-void HttpResponse::makeResponse(Buffer& buff) {
-    if (stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
-        code_ = 404;
-    } else if(!(mmFileStat_.st_mode & S_IROTH)) {
-        code_ = 403;
-    } else if (code_ == -1) {
-        code_ = 200;
+void HttpResponse::makeResponse(Buffer& buff, const HttpRequest* request) {
+    size_t start = buff.readableBytes();
+    ranges_.clear();
+    if (!CODE_PATH.count(code_)) {
+        // 先只取文件信息, 304 不需要打开和映射文件; 命中缓存时不需要任何系统调用
+        FileCache* cache = FileCache::Instance();
+        string path = srcDir_ + path_;
+        int err = 0;
+        if (!cache->statFile(path, &fileStat_, &err)) {
+            code_ = (err == EACCES) ? 403 : 404;
+        } else {
+            if (code_ == -1) code_ = 200;
+            if (code_ == 200 && selectEncoding_(request)) {
+                path += ".gz";
+            }
+            if (code_ == 200 && request && notModified_(*request)) {
+                code_ = 304;
+            } else {
+                file_ = cache->get(path, &err);
+                if (!file_) {
+                    code_ = (err == EACCES) ? 403 : 404;
+                } else {
+                    // 以实际映射的文件为准, 两次查询之间文件可能被替换
+                    fileStat_ = file_->st;
+                    if (code_ == 200 && request) selectRange_(*request);
+                }
+            }
+        }
+    }
+    parts_.clear();
+    if (CODE_PATH.count(code_)) {
+        LoadErrorPages(srcDir_);
+        if (addErrorPage_(buff, start)) return;
+        errorHtml_();
+    }
+    if (code_ == 200 && file_) {
+        addCachedHeader_(buff);
+        parts_.push_back({ buff.readableBytes() - start, 0, file_->size });
+        return;
     }
-    errorHtml_();
     addStateLine_(buff);
     addHeader_(buff);
-    addContent_(buff);
+    addContent_(buff, start);
+}
+
+void HttpResponse::addCachedHeader_(Buffer &buff) {
+    // 除了 Date, 响应头只由文件、保持连接和内容编码决定
+    int variant = (isKeepAlive_ ? 1 : 0) | (gzip_ ? 2 : 0) | (vary_ ? 4 : 0);
+    const string* header = file_->header(variant);
+    if (!header) {
+        Buffer tmp;
+        addHeader_(tmp);
+        tmp.append("Content-length: " + to_string(file_->size) + "\r\n\r\n");
+        header = file_->setHeader(variant, tmp.retrieveAllToString());
+    }
+    buff.append(STATUS_200, strlen(STATUS_200));
+    addDate_(buff);
+    buff.append(*header);
+}
+
+void HttpResponse::LoadErrorPages(const string& srcDir) {
+    call_once(errorPagesOnce_, [&srcDir] {
+        for (auto& [code, path] : CODE_PATH) {
+            // 拷贝一份, 之后磁盘上的页面被修改或删除都不影响
+            FileRef file = FileCache::Instance()->get(srcDir + path);
+            string fallback;
+            string_view content;
+            if (file && file->data) {
+                content = string_view(file->data, file->size);
+            } else {
+                Log_Warn("error page %s not found, use default", (srcDir + path).data());
+                fallback = ErrorBody_(code, "File NotFound!");
+                content = fallback;
+            }
+            ErrorPage page;
+            page.body = CachedFile::FromContent(content);
+            if (!page.body) continue;
+            page.status = "HTTP/1.1 " + to_string(code) + " " + CODE_STATUS.at(code) + "\r\n";
+            for (int keepAlive = 0; keepAlive < 2; keepAlive++) {
+                HttpResponse resp;
+                resp.code_ = code;
+                resp.isKeepAlive_ = keepAlive;
+                resp.path_ = path;
+                Buffer buff;
+                resp.addHeader_(buff);
+                if (code == 405) {
+                    buff.append("Allow: GET, POST\r\n");
+                }
+                buff.append("Content-length: " + to_string(page.body->size) + "\r\n\r\n");
+                page.header[keepAlive] = buff.retrieveAllToString();
+            }
+            errorPages_.emplace(code, move(page));
+        }
+    });
+}
+
+bool HttpResponse::addErrorPage_(Buffer& buff, size_t start) {
+    auto it = errorPages_.find(code_);
+    if (it == errorPages_.end()) return false;
+    const ErrorPage& page = it->second;
+    file_ = page.body;
+    buff.append(page.status);
+    addDate_(buff);
+    buff.append(page.header[isKeepAlive_]);
+    parts_.push_back({ buff.readableBytes() - start, 0, file_->size });
+    return true;
 }
 
 void HttpResponse::errorHtml_() {
     if (CODE_PATH.count(code_)) {
         path_ = CODE_PATH.at(code_);
-        stat((srcDir_ + path_).data(), &mmFileStat_);
+        file_ = FileCache::Instance()->get(srcDir_ + path_);
+    }
+}
+
+bool HttpResponse::selectEncoding_(const HttpRequest* request) {
+    // 大多数文件没有 .gz, 不存在的结果也要缓存, 否则每个请求多一次 stat
+    struct stat gzStat;
+    if (!FileCache::Instance()->statFile(srcDir_ + path_ + ".gz", &gzStat, nullptr, true)) {
+        return false;
+    }
+    // 原文件改过而 .gz 没有重新生成时不用它
+    const timespec& gzTime = gzStat.st_mtim;
+    const timespec& srcTime = fileStat_.st_mtim;
+    if (gzTime.tv_sec < srcTime.tv_sec || (gzTime.tv_sec == srcTime.tv_sec && gzTime.tv_nsec < srcTime.tv_nsec)) {
+        return false;
+    }
+    vary_ = true;
+    if (request && request->acceptsEncoding("gzip")) {
+        fileStat_ = gzStat;
+        gzip_ = true;
+    }
+    return gzip_;
+}
+
+size_t HttpResponse::formatEtag_(char* buf) const {
+    // 强校验: inode、大小和纳秒级修改时间任何一个变化都会变
+    uint64_t mtime = fileStat_.st_mtim.tv_sec * 1000000000ULL + fileStat_.st_mtim.tv_nsec;
+    return snprintf(buf, ETAG_LEN, "\"%lx-%lx-%lx\"", (unsigned long)fileStat_.st_ino,
+                    (unsigned long)fileStat_.st_size, (unsigned long)mtime);
+}
+
+bool HttpResponse::notModified_(const HttpRequest& request) const {
+    // 有 If-None-Match 时忽略 If-Modified-Since
+    string_view list = request.getHeader(HttpHeader::IF_NONE_MATCH);
+    if (list.data()) {
+        char etag[ETAG_LEN];
+        string_view ours(etag, formatEtag_(etag));
+        string_view item;
+        while (HttpHeader::NextListItem(list, &item)) {
+            // If-None-Match 用弱比较, 去掉 W/ 前缀
+            if (item.substr(0, 2) == "W/") item.remove_prefix(2);
+            if (item == "*" || item == ours) return true;
+        }
+        return false;
+    }
+    time_t since;
+    string_view value = request.getHeader(HttpHeader::IF_MODIFIED_SINCE);
+    return value.data() && HttpHeader::ParseDate(value, &since) && fileStat_.st_mtim.tv_sec <= since;
+}
+
+void HttpResponse::selectRange_(const HttpRequest& request) {
+    string_view range = request.getHeader(HttpHeader::RANGE);
+    if (!range.data()) return;
+    // If-Range 不匹配说明客户端手里的是旧版本, 忽略 Range 发送整个文件
+    string_view ifRange = request.getHeader(HttpHeader::IF_RANGE);
+    if (ifRange.data() && !ifRangeMatches_(ifRange)) return;
+    if (!ParseRange_(range, file_->size, &ranges_)) {
+        // 格式不对或者段数太多, 按规范忽略 Range
+        ranges_.clear();
+        return;
+    }
+    code_ = ranges_.empty() ? 416 : 206;
+}
+
+bool HttpResponse::ifRangeMatches_(string_view value) const {
+    if (!value.empty() && value.front() == '"') {
+        // If-Range 只认强校验
+        char etag[ETAG_LEN];
+        return value == string_view(etag, formatEtag_(etag));
+    }
+    time_t date;
+    return HttpHeader::ParseDate(value, &date) && date == fileStat_.st_mtim.tv_sec;
+}
+
+static bool ParseOffset(string_view value, size_t* n) {
+    if (value.empty() || value.size() > 18) return false;
+    size_t result = 0;
+    for (char ch : value) {
+        if (ch < '0' || ch > '9') return false;
+        result = result * 10 + (ch - '0');
+    }
+    *n = result;
+    return true;
+}
+
+// Range: bytes=0-99, 200-, -50
+bool HttpResponse::ParseRange_(string_view value, size_t size, vector<pair<size_t, size_t>>* ranges) {
+    static const string_view UNIT = "bytes=";
+    if (value.size() <= UNIT.size() || !HttpHeader::EqualsIgnoreCase(value.substr(0, UNIT.size()), UNIT)) {
+        return false;
+    }
+    string_view list = value.substr(UNIT.size());
+    string_view item;
+    int count = 0;
+    while (HttpHeader::NextListItem(list, &item)) {
+        if (++count > MAX_RANGES) return false;
+        size_t dash = item.find('-');
+        if (dash == string_view::npos) return false;
+        size_t first, last;
+        if (dash == 0) {
+            // 最后 n 个字节
+            if (!ParseOffset(item.substr(1), &last)) return false;
+            if (last == 0 || size == 0) continue;
+            first = size - min(last, size);
+            last = size - 1;
+        } else {
+            if (!ParseOffset(item.substr(0, dash), &first)) return false;
+            if (dash + 1 == item.size()) {
+                last = SIZE_MAX;
+            } else if (!ParseOffset(item.substr(dash + 1), &last) || last < first) {
+                return false;
+            }
+            // 起点超出文件的段无法满足, 跳过
+            if (first >= size) continue;
+            last = min(last, size - 1);
+        }
+        ranges->emplace_back(first, last - first + 1);
     }
+    return count > 0;
 }
 
 void HttpResponse::addStateLine_(Buffer &buff) {
     if (!CODE_STATUS.count(code_)) code_ = 400;
     string status = CODE_STATUS.at(code_);
     buff.append("HTTP/1.1 " + to_string(code_) + " " + status + "\r\n");
+    addDate_(buff);
+}
+
+void HttpResponse::addDate_(Buffer &buff) {
+    string_view date = HttpHeader::CurrentDate();
+    buff.append("Date: ", 6);
+    buff.append(date.data(), date.size());
+    buff.append("\r\n", 2);
 }
 
 void HttpResponse::addHeader_(Buffer &buff) {
@@ -95,44 +345,127 @@ void HttpResponse::addHeader_(Buffer &buff) {
     } else{
         buff.append("close\r\n");
     }
-    buff.append("Content-type: " + getFileType_() + "\r\n");
+    if (code_ == 206 && ranges_.size() > 1) {
+        buff.append("Content-type: multipart/byteranges; boundary=" + Boundary_() + "\r\n");
+    } else {
+        buff.append("Content-type: " + getFileType_() + "\r\n");
+    }
+    if (file_ && (code_ == 200 || code_ == 206)) {
+        buff.append("Accept-Ranges: bytes\r\n");
+    }
+    if (gzip_) {
+        buff.append("Content-Encoding: gzip\r\n");
+    }
+    if (vary_) {
+        buff.append("Vary: Accept-Encoding\r\n");
+    }
+    if (code_ == 200 || code_ == 206 || code_ == 304) {
+        addValidators_(buff);
+    }
 }
 
-void HttpResponse::addContent_(Buffer &buff) {
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
-    if (srcFd < 0) {
+void HttpResponse::addValidators_(Buffer& buff) {
+    char etag[ETAG_LEN];
+    size_t etagLen = formatEtag_(etag);
+    buff.append("ETag: ");
+    buff.append(etag, etagLen);
+    char date[HttpHeader::DATE_LEN + 1];
+    size_t dateLen = HttpHeader::FormatDate(fileStat_.st_mtim.tv_sec, date);
+    buff.append("\r\nLast-Modified: ");
+    buff.append(date, dateLen);
+    buff.append("\r\nCache-Control: ");
+    size_t idx = path_.find_last_of('.');
+    auto it = (idx == string::npos) ? SUFFIX_CACHE.end() : SUFFIX_CACHE.find(path_.substr(idx));
+    buff.append(it != SUFFIX_CACHE.end() ? it->second : DEFAULT_CACHE_CONTROL);
+    buff.append("\r\n");
+}
+
+void HttpResponse::addContent_(Buffer &buff, size_t start) {
+    if (code_ == 304) {
+        // 304 没有响应体
+        buff.append("\r\n");
+    } else if (code_ == 416) {
+        buff.append("Content-Range: bytes */" + to_string(fileStat_.st_size) + "\r\n");
+        buff.append("Content-length: 0\r\n\r\n");
+        file_.reset();
+    } else if (!file_) {
         Log_Error("file not found: %s", (srcDir_ + path_).data());
         errorContent(buff, "File NotFound!");
+    } else if (code_ == 206 && ranges_.size() > 1) {
+        addMultipart_(buff, start);
         return;
-    }
-    Log_Debug("file path %s", (srcDir_ + path_).data());
-    // 内存映射
-    int *mmRet = (int*)mmap(nullptr, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-    if (mmRet == MAP_FAILED) {
-        errorContent(buff, "File NotFound");
+    } else {
+        Log_Debug("file path %s", (srcDir_ + path_).data());
+        size_t offset = 0, len = file_->size;
+        if (code_ == 206) {
+            offset = ranges_[0].first;
+            len = ranges_[0].second;
+            buff.append("Content-Range: " + contentRange_(offset, len) + "\r\n");
+        }
+        buff.append("Content-length: " + to_string(len) + "\r\n\r\n");
+        parts_.push_back({ buff.readableBytes() - start, offset, len });
         return;
     }
-    mmFile_ = (char*)mmRet;
-    close(srcFd);
-    buff.append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+    parts_.push_back({ buff.readableBytes() - start, 0, 0 });
+}
+
+void HttpResponse::addMultipart_(Buffer& buff, size_t start) {
+    // 每一段前面有自己的分隔行和头部, 先全部生成出来才能算出 Content-length
+    string type = getFileType_();
+    string heads;
+    size_t total = 0;
+    for (auto& [offset, len] : ranges_) {
+        string head = "\r\n--" + Boundary_() + "\r\nContent-type: " + type
+                    + "\r\nContent-Range: " + contentRange_(offset, len) + "\r\n\r\n";
+        parts_.push_back({ head.size(), offset, len });
+        heads += head;
+        total += head.size() + len;
+    }
+    string tail = "\r\n--" + Boundary_() + "--\r\n";
+    total += tail.size();
+    buff.append("Content-length: " + to_string(total) + "\r\n\r\n");
+    // 响应头和第一段的头部连在一起发送
+    parts_[0].textLen += buff.readableBytes() - start;
+    buff.append(heads);
+    buff.append(tail);
+    parts_.push_back({ tail.size(), 0, 0 });
+}
+
+string HttpResponse::contentRange_(size_t offset, size_t len) const {
+    return "bytes " + to_string(offset) + "-" + to_string(offset + len - 1) + "/" + to_string(fileStat_.st_size);
+}
+
+const string& HttpResponse::Boundary_() {
+    // 每个进程随机生成一次, 不会恰好出现在文件内容里
+    static const string boundary = [] {
+        random_device rd;
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%08x%08x", rd(), rd());
+        return string(buf);
+    }();
+    return boundary;
 }
 
 void HttpResponse::errorContent(Buffer& buff, std::string message) {
+    string body = ErrorBody_(code_, message);
+    buff.append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
+    buff.append(body);
+}
+
+string HttpResponse::ErrorBody_(int code, const string& message) {
     string body;
     string status;
     body += "<html><title>Error</title>";
     body += "<body bgcolor=\"ffffff\">";
-    if(CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
+    if(CODE_STATUS.count(code) == 1) {
+        status = CODE_STATUS.find(code)->second;
     } else {
         status = "Bad Request";
     }
-    body += to_string(code_) + " : " + status  + "\n";
+    body += to_string(code) + " : " + status  + "\n";
     body += "<p>" + message + "</p>";
     body += "<hr><em>TinyWebServer</em></body></html>";
-
-    buff.append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
-    buff.append(body);
+    return body;
 }
 
 
@@ -149,18 +482,19 @@ string HttpResponse::getFileType_() const {
 
 
 void HttpResponse::unmapFile() {
-    if (mmFile_) {
-        munmap(mmFile_, mmFileStat_.st_size);
-        mmFile_ = nullptr;
-    }
+    file_.reset();
+}
+
+const char* HttpResponse::file() const {
+    return file_ ? file_->data : nullptr;
 }
 
-char* HttpResponse::file() {
-    return mmFile_;
+int HttpResponse::fileFd() const {
+    return file_ ? file_->fd : -1;
 }
 
 size_t HttpResponse::fileLen() const {
-    return mmFileStat_.st_size;
+    return file_ ? file_->size : 0;
 }
 
 
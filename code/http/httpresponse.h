@@ -2,49 +2,132 @@
 #define _HTTPRESPONSE_H_
 
 #include <unordered_map>
-#include <fcntl.h>       // open
-#include <unistd.h>      // close
-#include <sys/stat.h>    // stat
-#include <sys/mman.h>    // mmap, munmap
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include <errno.h>
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "filecache.h"
+#include "httpheader.h"
+
+class HttpRequest;
 
 class HttpResponse {
 public:
+    // 响应由若干段组成: 先是 makeResponse 按顺序写进 buff 的 textLen 字节, 再是文件中 [offset, offset + len) 这一段
+    // 普通响应只有一段; 多段 Range 每段前面有自己的分隔头, 最后一段只有结尾的分隔行
+    struct Part {
+        size_t textLen;
+        size_t offset;
+        size_t len;
+    };
+
     HttpResponse();
     ~HttpResponse();
 
-    void init(const std::string &srcDir, const std::string& path, bool isKeepAlive = false, int code = -1);
-    void makeResponse(Buffer& buff);
+    void init(const std::string &srcDir, std::string_view path, bool isKeepAlive = false, int code = -1);
+    // request 用来协商内容编码, 只在这次调用中使用, 可以为 nullptr
+    void makeResponse(Buffer& buff, const HttpRequest* request = nullptr);
+    // 释放对缓存文件的引用
     void unmapFile();
-    char* file();
+    // 文件没有映射时(大文件走 sendfile)返回 nullptr, 此时用 fileFd 发送
+    const char* file() const;
+    int fileFd() const;
     size_t fileLen() const;
     void errorContent(Buffer& buff, std::string message);
+
+    // 把 CODE_PATH 中的错误页面读进内存并生成响应头, 之后错误响应不再访问文件系统
+    // 只有第一次调用生效; 启动时没有调用过的话由第一个错误响应用它的 srcDir 载入
+    static void LoadErrorPages(const std::string& srcDir);
     int code() const { return code_; }
+    const std::vector<Part>& parts() const { return parts_; }
 
 
 private:
     void addStateLine_(Buffer &buff);
+    void addDate_(Buffer &buff);
+    // 完整的 200 文件响应: 状态行和 Date 之后直接拷贝缓存在文件上的响应头
+    void addCachedHeader_(Buffer &buff);
     void addHeader_(Buffer &buff);
-    void addContent_(Buffer &buff);
+    // start 是这个响应在 buff 中开始的位置
+    void addContent_(Buffer &buff, size_t start);
+    void addMultipart_(Buffer& buff, size_t start);
+
+    // 发送载入内存的错误页面, code_ 没有对应的页面时返回 false
+    bool addErrorPage_(Buffer& buff, size_t start);
 
     // 如果 code 是错误码, 将 path_ 改为对应的 html 路径
     void errorHtml_();
+
+    // 页面文件不存在时使用的错误页面
+    static std::string ErrorBody_(int code, const std::string& message);
+
+    // 文件旁边有预压缩的 .gz 时, 客户端支持 gzip 就改为发送 .gz, 返回是否选择了 .gz
+    bool selectEncoding_(const HttpRequest* request);
+
+    // 按 If-None-Match / If-Modified-Since 判断客户端的缓存是否还有效
+    bool notModified_(const HttpRequest& request) const;
+
+    // 按 Range / If-Range 设置 ranges_, 并把 code_ 改成 206 或 416
+    void selectRange_(const HttpRequest& request);
+
+    bool ifRangeMatches_(std::string_view value) const;
+
+    // 解析 Range, 格式错误或者段数超过 MAX_RANGES 返回 false; 能满足的段按顺序放进 ranges
+    static bool ParseRange_(std::string_view value, size_t size, std::vector<std::pair<size_t, size_t>>* ranges);
+
+    // "bytes first-last/size"
+    std::string contentRange_(size_t offset, size_t len) const;
+
+    static const std::string& Boundary_();
+
+    // ETag / Last-Modified / Cache-Control
+    void addValidators_(Buffer& buff);
+
+    // 带引号的 ETag 写入 buf, 返回长度
+    size_t formatEtag_(char* buf) const;
     
     //  获取文件对应的 Content-Type
     std::string getFileType_() const;
 
     int code_;
     bool isKeepAlive_;
+    // 发送的是 .gz 版本
+    bool gzip_;
+    // 存在 .gz 版本, 响应内容随 Accept-Encoding 变化
+    bool vary_;
 
     std::string path_;
     std::string srcDir_;
 
-    char* mmFile_;
-    struct stat mmFileStat_;
+    // 来自 FileCache, 和其它连接共享; 304 时为空
+    FileRef file_;
+    // 要发送的文件(可能是 .gz)的信息, 用来生成 ETag 和 Last-Modified
+    struct stat fileStat_;
+    // 206 时要发送的 (offset, len)
+    std::vector<std::pair<size_t, size_t>> ranges_;
+    std::vector<Part> parts_;
+
+    struct ErrorPage {
+        // 状态行
+        std::string status;
+        // Date 之后的响应头, 下标为是否保持连接
+        std::string header[2];
+        FileRef body;
+    };
+    // 载入后只读, 所有线程共享
+    static std::unordered_map<int, ErrorPage> errorPages_;
+    static std::once_flag errorPagesOnce_;
 
     static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;
+    static const std::unordered_map<std::string, std::string> SUFFIX_CACHE;
+    static constexpr const char* DEFAULT_CACHE_CONTROL = "public, max-age=3600";
+    // 三个 64 位十六进制数, 两个 '-', 两个引号和结尾的 '\0'
+    static const size_t ETAG_LEN = 3 * 16 + 2 + 2 + 1;
+    static const int MAX_RANGES = 16;
+    static constexpr const char* STATUS_200 = "HTTP/1.1 200 OK\r\n";
     static const std::unordered_map<int, std::string> CODE_STATUS;
     static const std::unordered_map<int, std::string> CODE_PATH;
 };
@@ -0,0 +1,257 @@
+#include "httpscan.h"
+#include <string.h>
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace HttpScan {
+
+namespace {
+
+using ScanFunc = const char* (*)(const char* begin, const char* end);
+
+inline bool IsAlpha(char ch) {
+    return static_cast<unsigned char>((ch | 0x20) - 'a') < 26;
+}
+
+// tchar: 字母、数字和 !#$%&'*+-.^_`|~
+// 按字节的低 4 位查表, 第 hi 位为 1 表示 (hi << 4 | lo) 是 tchar; 标量和向量实现共用, 向量实现用 pshufb 查
+alignas(16) const uint8_t TCHAR_LO[16] = {
+    0xe8, 0xfc, 0xf8, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc, 0xf8, 0xf8, 0xf4, 0x54, 0xd0, 0x54, 0xf4, 0x70,
+};
+// 高 4 位对应的位, 0x80 以上都不是 tchar
+alignas(16) const uint8_t TCHAR_HI[16] = {
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+inline bool IsTchar(char ch) {
+    unsigned char uch = static_cast<unsigned char>(ch);
+    return TCHAR_LO[uch & 0x0f] & TCHAR_HI[uch >> 4];
+}
+
+/* ---------- 标量实现 ---------- */
+
+const char* FindCrlfScalar(const char* begin, const char* end) {
+    const char* p = begin;
+    while (p < end) {
+        p = static_cast<const char*>(memchr(p, '\r', end - p));
+        if (!p || p + 1 >= end) return end;
+        if (p[1] == '\n') return p;
+        p++;
+    }
+    return end;
+}
+
+const char* FindCrOrLfScalar(const char* begin, const char* end) {
+    for (const char* p = begin; p < end; p++) {
+        if (*p == '\r' || *p == '\n') return p;
+    }
+    return end;
+}
+
+const char* SkipAlphaScalar(const char* begin, const char* end) {
+    const char* p = begin;
+    while (p < end && IsAlpha(*p)) p++;
+    return p;
+}
+
+const char* SkipTokenScalar(const char* begin, const char* end) {
+    const char* p = begin;
+    while (p < end && IsTchar(*p)) p++;
+    return p;
+}
+
+/* ---------- SSE4.2, 每次 16 字节 ---------- */
+
+__attribute__((target("sse4.2")))
+const char* FindCrlfSse42(const char* begin, const char* end) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const char* p = begin;
+    // 需要同时读 p 和 p + 1 开始的 16 字节
+    for (; end - p >= 17; p += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, cr)) & _mm_movemask_epi8(_mm_cmpeq_epi8(b, lf));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return FindCrlfScalar(p, end);
+}
+
+__attribute__((target("sse4.2")))
+const char* FindCrOrLfSse42(const char* begin, const char* end) {
+    const __m128i set = _mm_setr_epi8('\r', '\n', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const char* p = begin;
+    for (; end - p >= 16; p += 16) {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int index = _mm_cmpestri(set, 2, data, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (index < 16) return p + index;
+    }
+    return FindCrOrLfScalar(p, end);
+}
+
+__attribute__((target("sse4.2")))
+const char* SkipAlphaSse42(const char* begin, const char* end) {
+    const __m128i ranges = _mm_setr_epi8('A', 'Z', 'a', 'z', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const char* p = begin;
+    for (; end - p >= 16; p += 16) {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int index = _mm_cmpestri(ranges, 4, data, 16,
+                                 _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_MASKED_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT);
+        if (index < 16) return p + index;
+    }
+    return SkipAlphaScalar(p, end);
+}
+
+__attribute__((target("sse4.2")))
+const char* SkipTokenSse42(const char* begin, const char* end) {
+    const __m128i loTable = _mm_load_si128(reinterpret_cast<const __m128i*>(TCHAR_LO));
+    const __m128i hiTable = _mm_load_si128(reinterpret_cast<const __m128i*>(TCHAR_HI));
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    const char* p = begin;
+    for (; end - p >= 16; p += 16) {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i lo = _mm_shuffle_epi8(loTable, _mm_and_si128(data, nibble));
+        __m128i hi = _mm_shuffle_epi8(hiTable, _mm_and_si128(_mm_srli_epi16(data, 4), nibble));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return SkipTokenScalar(p, end);
+}
+
+/* ---------- AVX2, 每次 32 字节 ---------- */
+
+__attribute__((target("avx2")))
+const char* FindCrlfAvx2(const char* begin, const char* end) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const char* p = begin;
+    for (; end - p >= 33; p += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, cr)))
+                      & static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, lf)));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return FindCrlfSse42(p, end);
+}
+
+__attribute__((target("avx2")))
+const char* FindCrOrLfAvx2(const char* begin, const char* end) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const char* p = begin;
+    for (; end - p >= 32; p += 32) {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(data, cr), _mm256_cmpeq_epi8(data, lf));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return FindCrOrLfSse42(p, end);
+}
+
+__attribute__((target("avx2")))
+const char* SkipAlphaAvx2(const char* begin, const char* end) {
+    // (ch | 0x20) - 'a' 落在 [0, 25] 的就是字母
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    const __m256i a = _mm256_set1_epi8('a');
+    const __m256i limit = _mm256_set1_epi8(25);
+    const char* p = begin;
+    for (; end - p >= 32; p += 32) {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i offset = _mm256_sub_epi8(_mm256_or_si256(data, lower), a);
+        __m256i alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, limit), offset);
+        unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(alpha));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return SkipAlphaSse42(p, end);
+}
+
+__attribute__((target("avx2")))
+const char* SkipTokenAvx2(const char* begin, const char* end) {
+    // vpshufb 在每个 128 位内查表, 两半放同样的表
+    const __m256i loTable = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(TCHAR_LO)));
+    const __m256i hiTable = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(TCHAR_HI)));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    const char* p = begin;
+    for (; end - p >= 32; p += 32) {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i lo = _mm256_shuffle_epi8(loTable, _mm256_and_si256(data, nibble));
+        __m256i hi = _mm256_shuffle_epi8(hiTable, _mm256_and_si256(_mm256_srli_epi16(data, 4), nibble));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), zero)));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return SkipTokenSse42(p, end);
+}
+
+/* ---------- 分发 ---------- */
+
+struct Kernels {
+    Level level;
+    const char* name;
+    ScanFunc findCrlf;
+    ScanFunc findCrOrLf;
+    ScanFunc skipAlpha;
+    ScanFunc skipToken;
+};
+
+const Kernels KERNELS[] = {
+    { SCALAR, "scalar", FindCrlfScalar, FindCrOrLfScalar, SkipAlphaScalar, SkipTokenScalar },
+    { SSE42,  "sse4.2", FindCrlfSse42,  FindCrOrLfSse42,  SkipAlphaSse42,  SkipTokenSse42 },
+    { AVX2,   "avx2",   FindCrlfAvx2,   FindCrOrLfAvx2,   SkipAlphaAvx2,   SkipTokenAvx2 },
+};
+
+bool Supported(Level level) {
+    __builtin_cpu_init();
+    switch (level) {
+    case AVX2:
+        return __builtin_cpu_supports("avx2");
+    case SSE42:
+        return __builtin_cpu_supports("sse4.2");
+    default:
+        return true;
+    }
+}
+
+const Kernels* Best() {
+    if (Supported(AVX2)) return &KERNELS[AVX2];
+    if (Supported(SSE42)) return &KERNELS[SSE42];
+    return &KERNELS[SCALAR];
+}
+
+const Kernels* current = Best();
+
+}
+
+const char* FindCrlf(const char* begin, const char* end) {
+    return current->findCrlf(begin, end);
+}
+
+const char* FindCrOrLf(const char* begin, const char* end) {
+    return current->findCrOrLf(begin, end);
+}
+
+const char* SkipAlpha(const char* begin, const char* end) {
+    return current->skipAlpha(begin, end);
+}
+
+const char* SkipToken(const char* begin, const char* end) {
+    return current->skipToken(begin, end);
+}
+
+Level GetLevel() {
+    return current->level;
+}
+
+const char* GetLevelName() {
+    return current->name;
+}
+
+bool SetLevel(Level level) {
+    if (!Supported(level)) return false;
+    current = &KERNELS[level];
+    return true;
+}
+
+}
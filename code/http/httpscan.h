@@ -0,0 +1,38 @@
+#ifndef _HTTPSCAN_H_
+#define _HTTPSCAN_H_
+
+#include <stddef.h>
+
+// 请求解析用的分隔符扫描, 启动时按 CPU 选择 AVX2 (32 字节) / SSE4.2 (16 字节) / 标量实现
+// 所有函数在 [begin, end) 中查找, 找不到时返回 end, 不会读取 end 之后的内存
+namespace HttpScan {
+
+enum Level {
+    SCALAR = 0,
+    SSE42,
+    AVX2,
+};
+
+// 第一个 "\r\n" 中 '\r' 的位置
+const char* FindCrlf(const char* begin, const char* end);
+
+// 第一个 '\r' 或 '\n' 的位置, 用于检查头部值里有没有单独的换行
+const char* FindCrOrLf(const char* begin, const char* end);
+
+// 第一个不是字母的位置, 用于校验请求方法
+const char* SkipAlpha(const char* begin, const char* end);
+
+// 第一个不是 token 字符 (RFC 7230 tchar) 的位置, 用于校验头部名
+const char* SkipToken(const char* begin, const char* end);
+
+// 当前使用的实现
+Level GetLevel();
+
+const char* GetLevelName();
+
+// 切换实现, CPU 不支持时返回 false, 只用于测试
+bool SetLevel(Level level);
+
+}
+
+#endif
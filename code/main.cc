@@ -9,6 +9,8 @@ int main() {
     WebServer server(
         1316, 3, 60000, false,             /* 端口 ET模式 timeoutMs 优雅退出  */
         3306, "root", "1004535809", "testdb", /* Mysql配置 */
-        12, 6, true, Log::LogLevel::INFO, 1024);             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        12, 6, true, Log::LogLevel::INFO, 1024,              /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        0, false,                                            /* Reactor 数量(0 为单 Reactor + 线程池) 是否使用 io_uring */
+        false, false, false);                                /* 线程绑定 CPU 多 Reactor 时设置 SO_INCOMING_CPU 连接固定到工作线程 */
     server.start();
 }
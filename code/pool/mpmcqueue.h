@@ -0,0 +1,119 @@
+#ifndef _MPMCQUEUE_H_
+#define _MPMCQUEUE_H_
+
+#include <atomic>
+#include <thread>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+
+// 固定容量的无锁多生产者多消费者环形队列(Vyukov), 元素是指针
+// 每个槽有一个序号: 等于位置时可写, 等于位置 + 1 时可读, 生产者和消费者各自只竞争一个位置计数器
+// 满了 push 返回 false, 由调用方放到别处
+template <typename T, size_t N = 4096>
+class MpmcQueue {
+public:
+    static const size_t CAPACITY = N;
+
+    MpmcQueue(): enqueuePos_(0), dequeuePos_(0) {
+        for (size_t i = 0; i < CAPACITY; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+            cells_[i].item = nullptr;
+        }
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    bool push(T* item) {
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[pos & MASK];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (dif == 0) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                // 这个槽上一轮的元素还没被取走, 满了
+                return false;
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->item = item;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 一次占用连续的 n 个位置, 按顺序放入 items 的前若干个, 返回放入的个数, 空间不够时只放一部分
+    size_t pushBatch(T* const* items, size_t n) {
+        if (n == 0) return 0;
+        // 先读 dequeuePos_ 再读 enqueuePos_, 保证 pos 不小于 deq
+        size_t deq = dequeuePos_.load(std::memory_order_acquire);
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        size_t count;
+        while (true) {
+            size_t used = pos - deq;
+            if (used >= CAPACITY) return 0;
+            count = n < CAPACITY - used ? n : CAPACITY - used;
+            if (enqueuePos_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) break;
+            deq = dequeuePos_.load(std::memory_order_acquire);
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < count; i++) {
+            Cell& cell = cells_[(pos + i) & MASK];
+            // 这些位置上一轮的元素都已经被消费者占下, 只可能还在拷贝出去, 等它放开
+            while (cell.seq.load(std::memory_order_acquire) != pos + i) {
+                std::this_thread::yield();
+            }
+            cell.item = items[i];
+            cell.seq.store(pos + i + 1, std::memory_order_release);
+        }
+        return count;
+    }
+
+    // 空时返回 nullptr; 生产者占了位置还没放入时也当作空
+    T* pop() {
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[pos & MASK];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (dif == 0) {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return nullptr;
+            } else {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        T* item = cell->item;
+        cell->seq.store(pos + CAPACITY, std::memory_order_release);
+        return item;
+    }
+
+    // 近似值, 包括生产者已经占下还没放入的位置
+    size_t size() const {
+        size_t deq = dequeuePos_.load(std::memory_order_relaxed);
+        size_t enq = enqueuePos_.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+private:
+    static const size_t MASK = CAPACITY - 1;
+    static_assert((CAPACITY & MASK) == 0, "CAPACITY must be a power of 2");
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        T* item;
+    };
+
+    // 生产者和消费者的计数器放在不同的缓存行
+    alignas(64) std::atomic<size_t> enqueuePos_;
+    alignas(64) std::atomic<size_t> dequeuePos_;
+    alignas(64) Cell cells_[CAPACITY];
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef _TASK_H_
+#define _TASK_H_
+
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <type_traits>
+#include <assert.h>
+
+// 只能移动的 void() 可调用对象, 用来代替线程池任务和计时器回调里的 std::function
+// 捕获的内容直接放在对象内部的固定缓冲区里, 从不分配内存; 放不下时编译报错, 而不是悄悄退回到堆上
+class Task {
+public:
+    // 6 个指针, 够放 [this, reactor, client] 这类捕获, 也放得下一个 std::function
+    static const size_t CAPACITY = 6 * sizeof(void*);
+
+    Task() noexcept: ops_(nullptr) {}
+
+    Task(std::nullptr_t) noexcept: ops_(nullptr) {}
+
+    template <typename F, typename Fn = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same<Fn, Task>::value>>
+    Task(F&& f): ops_(nullptr) {
+        static_assert(sizeof(Fn) <= CAPACITY, "captures too large for Task");
+        static_assert(alignof(Fn) <= alignof(std::max_align_t), "over-aligned callable");
+        static_assert(std::is_nothrow_move_constructible<Fn>::value, "callable must be nothrow movable");
+        new (buf_) Fn(std::forward<F>(f));
+        ops_ = &OPS<Fn>;
+    }
+
+    Task(Task&& other) noexcept: ops_(other.ops_) {
+        if (ops_) {
+            ops_->move(buf_, other.buf_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            if (other.ops_) {
+                other.ops_->move(buf_, other.buf_);
+                ops_ = other.ops_;
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t) noexcept {
+        reset();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    void operator()() {
+        assert(ops_);
+        ops_->invoke(buf_);
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void reset() noexcept {
+        if (ops_) {
+            ops_->destroy(buf_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* self);
+        // 移动构造到 dst, 并析构 src
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* self);
+    };
+
+    template <typename Fn>
+    static constexpr Ops OPS = {
+        [](void* self) { (*static_cast<Fn*>(self))(); },
+        [](void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        },
+        [](void* self) { static_cast<Fn*>(self)->~Fn(); },
+    };
+
+    alignas(std::max_align_t) unsigned char buf_[CAPACITY];
+    const Ops* ops_;
+};
+
+#endif
@@ -0,0 +1,527 @@
+#include "threadpool.h"
+#include <chrono>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+using namespace std;
+
+// 值已经不是 expected 时立即返回, 被信号打断或者虚假唤醒由调用方重新检查; 超时返回 false
+static bool FutexWait(atomic<uint32_t>* addr, uint32_t expected, int64_t timeoutNs = -1) {
+    struct timespec ts;
+    if (timeoutNs >= 0) {
+        ts.tv_sec = timeoutNs / 1000000000;
+        ts.tv_nsec = timeoutNs % 1000000000;
+    }
+    long ret = syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, expected,
+                       timeoutNs >= 0 ? &ts : nullptr, nullptr, 0);
+    return !(ret < 0 && errno == ETIMEDOUT);
+}
+
+static void FutexWake(atomic<uint32_t>* addr, int n) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+}
+
+static int64_t NowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 当前线程所属的线程池和下标, 用来把工作线程里提交的任务放进自己的队列
+static thread_local void* currentPool = nullptr;
+static thread_local int currentIdx = -1;
+
+// 公共空闲链表只在线程本地链表用完或者攒多了的时候才访问, 一次交换 NODE_BATCH 个节点
+// 节点只增不减, 总数不超过同时在队列里的任务数的峰值
+struct ThreadPool::NodeCache {
+    struct Shared {
+        std::mutex mtx;
+        TaskNode* head = nullptr;
+    };
+
+    ~NodeCache() {
+        // 线程退出, 本地的节点交回公共链表
+        if (!head) return;
+        TaskNode* tail = head;
+        while (tail->next) tail = tail->next;
+        Shared& shared = GetShared();
+        lock_guard<mutex> locker(shared.mtx);
+        tail->next = shared.head;
+        shared.head = head;
+    }
+
+    // 进程退出时其它线程可能还在使用, 不析构
+    static Shared& GetShared() {
+        static Shared* shared = new Shared;
+        return *shared;
+    }
+
+    static NodeCache& Local() {
+        thread_local NodeCache cache;
+        return cache;
+    }
+
+    TaskNode* head = nullptr;
+    size_t count = 0;
+};
+
+ThreadPool::TaskNode* ThreadPool::AllocNode_() {
+    NodeCache& cache = NodeCache::Local();
+    if (!cache.head) {
+        NodeCache::Shared& shared = NodeCache::GetShared();
+        lock_guard<mutex> locker(shared.mtx);
+        while (shared.head && cache.count < NODE_BATCH) {
+            TaskNode* node = shared.head;
+            shared.head = node->next;
+            node->next = cache.head;
+            cache.head = node;
+            cache.count++;
+        }
+    }
+    if (!cache.head) return new TaskNode;
+    TaskNode* node = cache.head;
+    cache.head = node->next;
+    cache.count--;
+    node->next = nullptr;
+    return node;
+}
+
+void ThreadPool::FreeNode_(TaskNode* node) {
+    node->task.reset();
+    NodeCache& cache = NodeCache::Local();
+    node->next = cache.head;
+    cache.head = node;
+    if (++cache.count < 2 * NODE_BATCH) return;
+    // 执行任务的线程一般不提交任务, 节点会越攒越多, 分出一批交回去
+    TaskNode* first = cache.head;
+    TaskNode* last = first;
+    for (size_t i = 1; i < NODE_BATCH; i++) last = last->next;
+    cache.head = last->next;
+    cache.count -= NODE_BATCH;
+    NodeCache::Shared& shared = NodeCache::GetShared();
+    lock_guard<mutex> locker(shared.mtx);
+    last->next = shared.head;
+    shared.head = first;
+}
+
+ThreadPool::ThreadPool(size_t threadCount): ThreadPool(threadCount, threadCount) {}
+
+ThreadPool::ThreadPool(size_t minThreads, size_t maxThreads, int idleTimeoutMs, vector<int> cpus):
+    pool_(make_shared<Pool>()) {
+    assert(minThreads > 0 && minThreads <= maxThreads && idleTimeoutMs > 0);
+    pool_->minThreads = minThreads;
+    pool_->maxThreads = maxThreads;
+    pool_->idleTimeoutMs = idleTimeoutMs;
+    pool_->cpus = std::move(cpus);
+    pool_->lastBusyNs = NowNs();
+    for (size_t i = 0; i < maxThreads; i++) {
+        pool_->workers.push_back(make_unique<Worker>());
+    }
+    for (size_t i = 0; i < minThreads; i++) {
+        pool_->spawn();
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    if (!pool_) return;
+    {
+        // 之后不会再启动新线程
+        lock_guard<mutex> locker(pool_->spawnMtx);
+        pool_->isClosed.store(true, memory_order_seq_cst);
+    }
+    for (size_t i = 0; i < pool_->workers.size(); i++) {
+        pool_->wakeWorker(i);
+    }
+    // 工作线程把能看到的任务都执行完才退出; 之前空闲退出的线程也在这里 join
+    for (auto& worker : pool_->workers) {
+        if (worker->thread.joinable()) worker->thread.join();
+    }
+}
+
+size_t ThreadPool::threadCount() const {
+    return pool_->threads.load(memory_order_relaxed);
+}
+
+bool ThreadPool::overloaded() const {
+    if (!pool_->overloaded.load(memory_order_relaxed)) return false;
+    // 拒绝请求之后可能一直没有任务, 窗口不再更新, 过期的结果不算
+    return NowNs() - pool_->delayWindowNs.load(memory_order_relaxed) < 2 * SHED_INTERVAL_NS;
+}
+
+ThreadPool::BlockingScope::BlockingScope(): pool_(static_cast<Pool*>(currentPool)) {
+    if (!pool_) return;
+    Worker& worker = *pool_->workers[currentIdx];
+    worker.blocking.store(true, memory_order_seq_cst);
+    size_t blocked = pool_->blocked.fetch_add(1, memory_order_seq_cst) + 1;
+    if (blocked >= pool_->threads.load(memory_order_relaxed) && pool_->hasWork(-1)) {
+        pool_->grow(NowNs());
+    }
+    if (worker.inbox.size() > 0) {
+        // 自己的收件队列里的任务现在可以被窃取, 叫一个线程来
+        pool_->wake(1);
+    }
+}
+
+ThreadPool::BlockingScope::~BlockingScope() {
+    if (!pool_) return;
+    pool_->workers[currentIdx]->blocking.store(false, memory_order_relaxed);
+    pool_->blocked.fetch_sub(1, memory_order_relaxed);
+}
+
+bool ThreadPool::Pool::spawn() {
+    lock_guard<mutex> locker(spawnMtx);
+    if (isClosed.load(memory_order_relaxed) || threads.load(memory_order_relaxed) >= maxThreads) return false;
+    for (size_t i = 0; i < workers.size(); i++) {
+        Worker& worker = *workers[i];
+        if (worker.active) continue;
+        // 之前用这个槽位的线程已经退出 run, 不再访问线程池
+        if (worker.thread.joinable()) worker.thread.join();
+        worker.active = true;
+        threads.fetch_add(1, memory_order_relaxed);
+        int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        worker.thread = thread([this, i, cpu] {
+            if (cpu >= 0) {
+                // 线程自己绑定, 之后线程本地的节点缓存等都在这个 CPU 的 NUMA 节点上分配
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            }
+            run(i);
+        });
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::Pool::grow(int64_t now) {
+    if (threads.load(memory_order_relaxed) >= maxThreads) return;
+    int64_t last = lastGrowNs.load(memory_order_relaxed);
+    if (now - last < GROW_INTERVAL_NS) return;
+    if (!lastGrowNs.compare_exchange_strong(last, now, memory_order_relaxed)) return;
+    spawn();
+}
+
+bool ThreadPool::Pool::retire(int idx) {
+    lock_guard<mutex> locker(spawnMtx);
+    if (isClosed.load(memory_order_relaxed) || threads.load(memory_order_relaxed) <= minThreads) return false;
+    int64_t now = NowNs();
+    if (saturated.exchange(false, memory_order_relaxed)) {
+        lastBusyNs = now;
+        return false;
+    }
+    // 每个冷却期最多退出一个, 逐步收缩
+    if (now - lastBusyNs < static_cast<int64_t>(idleTimeoutMs) * 1000000) return false;
+    lastBusyNs = now;
+    workers[idx]->active = false;
+    threads.fetch_sub(1, memory_order_relaxed);
+    return true;
+}
+
+ThreadPool::Pool::~Pool() {
+    // 所有工作线程都已退出, 关闭之后才提交的任务不再执行
+    while (TaskNode* node = inject.pop()) FreeNode_(node);
+    while (overflowHead) {
+        TaskNode* node = overflowHead;
+        overflowHead = node->next;
+        FreeNode_(node);
+    }
+    for (auto& worker : workers) {
+        while (TaskNode* node = worker->deque.pop()) FreeNode_(node);
+        while (TaskNode* node = worker->inbox.pop()) FreeNode_(node);
+    }
+}
+
+void ThreadPool::Pool::submit(TaskNode* node) {
+    node->enqueueNs = NowNs();
+    if (currentPool == this && workers[currentIdx]->deque.push(node)) {
+        wake(1);
+        return;
+    }
+    if (overflowSize.load(memory_order_relaxed) > 0 || !inject.push(node)) {
+        pushOverflow(&node, 1);
+    }
+    wake(1);
+}
+
+void ThreadPool::Pool::submitBatch(TaskNode* const* nodes, size_t n) {
+    int64_t now = NowNs();
+    for (size_t i = 0; i < n; i++) nodes[i]->enqueueNs = now;
+    size_t done = 0;
+    if (currentPool == this) {
+        WorkDeque<TaskNode>& deque = workers[currentIdx]->deque;
+        while (done < n && deque.push(nodes[done])) done++;
+    }
+    if (done < n && overflowSize.load(memory_order_relaxed) == 0) {
+        done += inject.pushBatch(nodes + done, n - done);
+    }
+    if (done < n) pushOverflow(nodes + done, n - done);
+    wake(static_cast<int>(min(n, static_cast<size_t>(INT_MAX))));
+}
+
+void ThreadPool::Pool::submitHomed(const pair<TaskNode*, int>* nodes, size_t n, vector<TaskNode*>* rest) {
+    int64_t now = NowNs();
+    for (size_t i = 0; i < n; i++) {
+        nodes[i].first->enqueueNs = now;
+        if (!workers[nodes[i].second]->inbox.push(nodes[i].first)) rest->push_back(nodes[i].first);
+    }
+    // 都放完再唤醒, 每个线程只唤醒一次
+    for (size_t i = 0; i < workers.size(); i++) {
+        if (workers[i]->inbox.size() > 0) wakeHome(i);
+    }
+}
+
+int ThreadPool::Pool::homeOf(size_t key) const {
+    size_t n = workers.size();
+    for (size_t i = 0; i < n; i++) {
+        size_t idx = (key + i) % n;
+        if (workers[idx]->active.load(memory_order_relaxed)) return idx;
+    }
+    return -1;
+}
+
+bool ThreadPool::Pool::pushHome(TaskNode* node, int home) {
+    node->enqueueNs = NowNs();
+    return workers[home]->inbox.push(node);
+}
+
+void ThreadPool::Pool::wakeHome(int home) {
+    Worker& worker = *workers[home];
+    // 和 park 中先设置 sleeping 再检查任务配对
+    atomic_thread_fence(memory_order_seq_cst);
+    if (worker.sleeping.load(memory_order_relaxed)) {
+        wakeWorker(home);
+    } else if (canStealInbox(home)) {
+        wake(1);
+    }
+}
+
+void ThreadPool::Pool::pushOverflow(TaskNode* const* nodes, size_t n) {
+    lock_guard<mutex> locker(overflowMtx);
+    for (size_t i = 0; i < n; i++) {
+        TaskNode* node = nodes[i];
+        node->next = nullptr;
+        if (overflowTail) overflowTail->next = node;
+        else overflowHead = node;
+        overflowTail = node;
+    }
+    overflowSize.store(overflowSize.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+void ThreadPool::Pool::wake(int n) {
+    // 和 park 中先增加 idle 再检查任务配对, 两边至少有一边能看到对方
+    atomic_thread_fence(memory_order_seq_cst);
+    int parked = idle.load(memory_order_relaxed);
+    if (parked > 0) {
+        size_t count = workers.size();
+        size_t start = wakeCursor.fetch_add(1, memory_order_relaxed);
+        for (size_t i = 0; i < count && n > 0; i++) {
+            size_t idx = (start + i) % count;
+            if (workers[idx]->sleeping.load(memory_order_relaxed)) {
+                wakeWorker(idx);
+                n--;
+            }
+        }
+    } else if (blocked.load(memory_order_relaxed) >= threads.load(memory_order_relaxed)) {
+        // 所有线程都阻塞在数据库上, 不用等排队超时
+        grow(NowNs());
+    }
+}
+
+void ThreadPool::Pool::observeDelay(int64_t delayNs, int64_t now) {
+    int64_t minDelay = minDelayNs.load(memory_order_relaxed);
+    while (delayNs < minDelay && !minDelayNs.compare_exchange_weak(minDelay, delayNs, memory_order_relaxed)) {}
+    int64_t start = delayWindowNs.load(memory_order_relaxed);
+    if (now - start < SHED_INTERVAL_NS) return;
+    // 只有一个线程结束这个窗口
+    if (!delayWindowNs.compare_exchange_strong(start, now, memory_order_relaxed)) return;
+    minDelay = minDelayNs.exchange(INT64_MAX, memory_order_relaxed);
+    // 还能补充线程时先补充, 不拒绝
+    bool over = minDelay != INT64_MAX && minDelay > SHED_TARGET_NS
+        && threads.load(memory_order_relaxed) >= maxThreads;
+    if (over != overloaded.load(memory_order_relaxed)) overloaded.store(over, memory_order_relaxed);
+}
+
+void ThreadPool::Pool::wakeWorker(int idx) {
+    Worker& worker = *workers[idx];
+    worker.epoch.fetch_add(1, memory_order_seq_cst);
+    FutexWake(&worker.epoch, 1);
+}
+
+void ThreadPool::Pool::run(int idx) {
+    currentPool = this;
+    currentIdx = idx;
+    uint32_t seed = idx * 2654435761u + 1;
+    uint32_t tick = 0;
+    int spins = 0;
+    Worker& worker = *workers[idx];
+    while (true) {
+        TaskNode* node = find(idx, &seed, ++tick);
+        if (node) {
+            int64_t now = NowNs();
+            if (idle.load(memory_order_relaxed) == 0) {
+                if (!saturated.load(memory_order_relaxed)) saturated.store(true, memory_order_relaxed);
+                if (threads.load(memory_order_relaxed) < maxThreads && now - node->enqueueNs > GROW_DELAY_NS) {
+                    grow(now);
+                }
+            }
+            observeDelay(now - node->enqueueNs, now);
+            worker.busySinceNs.store(now, memory_order_relaxed);
+            node->task();
+            worker.busySinceNs.store(0, memory_order_relaxed);
+            FreeNode_(node);
+            spins = 0;
+            continue;
+        }
+        // 关闭后把能看到的任务都执行完再退出
+        if (isClosed.load(memory_order_acquire) && !hasWork(idx)) break;
+        if (++spins < SPIN_ROUNDS) {
+            this_thread::yield();
+            continue;
+        }
+        spins = 0;
+        // 队列空了, 排队时间按 0 算
+        observeDelay(0, NowNs());
+        // 比 minThreads 多出来的线程等待有超时, 超时后还没有任务就退出
+        bool timed = threads.load(memory_order_relaxed) > minThreads;
+        if (!park(idx, timed) && !hasWork(idx) && retire(idx)) {
+            // 退出前刚好有任务放进了自己的收件队列, 现在别人可以窃取了; 和 wakeHome 先放入再检查 active 配对
+            atomic_thread_fence(memory_order_seq_cst);
+            if (worker.inbox.size() > 0) wake(1);
+            break;
+        }
+    }
+    currentPool = nullptr;
+    currentIdx = -1;
+}
+
+ThreadPool::TaskNode* ThreadPool::Pool::find(int idx, uint32_t* seed, uint32_t tick) {
+    TaskNode* node = nullptr;
+    Worker& worker = *workers[idx];
+    if (tick % INJECT_INTERVAL == 0) {
+        node = worker.inbox.pop();
+        if (!node) node = pollInject(idx);
+    }
+    if (!node) node = worker.deque.pop();
+    if (!node) node = worker.inbox.pop();
+    if (!node) node = pollInject(idx);
+    if (!node) node = steal(idx, seed);
+    return node;
+}
+
+ThreadPool::TaskNode* ThreadPool::Pool::pollInject(int idx) {
+    size_t ringSize = inject.size();
+    size_t overflow = overflowSize.load(memory_order_relaxed);
+    if (ringSize == 0 && overflow == 0) return nullptr;
+    TaskNode* batch[INJECT_BATCH];
+    // 按线程数平分, 给别的线程留一些
+    size_t want = min((ringSize + overflow) / max<size_t>(threads.load(memory_order_relaxed), 1) + 1, INJECT_BATCH);
+    size_t n = 0;
+    while (n < want) {
+        TaskNode* node = inject.pop();
+        if (!node) break;
+        batch[n++] = node;
+    }
+    if (n < want && overflow > 0) {
+        // 溢出链表里的都比提交队列里的晚, 提交队列取空了才取
+        lock_guard<mutex> locker(overflowMtx);
+        size_t size = overflowSize.load(memory_order_relaxed);
+        size_t take = min(want - n, size);
+        for (size_t i = 0; i < take; i++) {
+            batch[n++] = overflowHead;
+            overflowHead = overflowHead->next;
+        }
+        if (!overflowHead) overflowTail = nullptr;
+        overflowSize.store(size - take, memory_order_relaxed);
+    }
+    if (n == 0) return nullptr;
+    // 第一个直接执行, 其余的倒序放进自己的队列, 这样自己从底部按提交顺序取
+    WorkDeque<TaskNode>& deque = workers[idx]->deque;
+    size_t pushed = 0;
+    for (size_t i = n - 1; i > 0; i--) {
+        if (!deque.push(batch[i])) {
+            // 自己的队列满了, 放回溢出链表的头部
+            lock_guard<mutex> locker(overflowMtx);
+            batch[i]->next = overflowHead;
+            for (size_t j = i - 1; j > 0; j--) batch[j]->next = batch[j + 1];
+            overflowHead = batch[1];
+            if (!overflowTail) overflowTail = batch[i];
+            overflowSize.store(overflowSize.load(memory_order_relaxed) + i, memory_order_relaxed);
+            break;
+        }
+        pushed++;
+    }
+    if (pushed > 0) wake(1);
+    return batch[0];
+}
+
+ThreadPool::TaskNode* ThreadPool::Pool::steal(int idx, uint32_t* seed) {
+    size_t n = workers.size();
+    if (n <= 1) return nullptr;
+    // xorshift 随机选起点, 避免所有空闲线程同时盯着同一个队列
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    size_t start = *seed % n;
+    for (size_t i = 0; i < n; i++) {
+        size_t victim = (start + i) % n;
+        if (victim == static_cast<size_t>(idx)) continue;
+        WorkDeque<TaskNode>& deque = workers[victim]->deque;
+        if (!deque.empty()) {
+            if (TaskNode* node = deque.steal()) return node;
+        }
+        if (canStealInbox(victim)) {
+            if (TaskNode* node = workers[victim]->inbox.pop()) return node;
+        }
+    }
+    return nullptr;
+}
+
+bool ThreadPool::Pool::canStealInbox(int victim) const {
+    const Worker& worker = *workers[victim];
+    size_t size = worker.inbox.size();
+    if (size == 0) return false;
+    if (size >= INBOX_STEAL_MIN || worker.blocking.load(memory_order_relaxed)
+        || !worker.active.load(memory_order_relaxed)) {
+        return true;
+    }
+    int64_t busySince = worker.busySinceNs.load(memory_order_relaxed);
+    return busySince > 0 && NowNs() - busySince > INBOX_STEAL_DELAY_NS;
+}
+
+bool ThreadPool::Pool::hasWork(int idx) const {
+    if (inject.size() > 0 || overflowSize.load(memory_order_relaxed) > 0) return true;
+    if (idx >= 0 && workers[idx]->inbox.size() > 0) return true;
+    for (size_t i = 0; i < workers.size(); i++) {
+        if (!workers[i]->deque.empty()) return true;
+        if (static_cast<int>(i) != idx && canStealInbox(i)) return true;
+    }
+    return false;
+}
+
+bool ThreadPool::Pool::park(int idx, bool timed) {
+    Worker& worker = *workers[idx];
+    worker.sleeping.store(true, memory_order_seq_cst);
+    idle.fetch_add(1, memory_order_seq_cst);
+    uint32_t key = worker.epoch.load(memory_order_seq_cst);
+    atomic_thread_fence(memory_order_seq_cst);
+    bool woken = true;
+    if (!hasWork(idx) && !isClosed.load(memory_order_relaxed)) {
+        // 别的线程的收件队列里有暂时不能窃取的任务时, 过一会儿回来看它的所属线程是不是还没空
+        bool pending = false;
+        for (size_t i = 0; i < workers.size() && !pending; i++) {
+            pending = static_cast<int>(i) != idx && workers[i]->inbox.size() > 0;
+        }
+        int64_t timeoutNs = timed ? static_cast<int64_t>(idleTimeoutMs) * 1000000 : -1;
+        if (pending) timeoutNs = INBOX_STEAL_DELAY_NS;
+        // 记下 key 之后有人唤醒时 epoch 已经变了, 立即返回
+        woken = FutexWait(&worker.epoch, key, timeoutNs) || pending;
+    }
+    worker.sleeping.store(false, memory_order_relaxed);
+    idle.fetch_sub(1, memory_order_relaxed);
+    return woken;
+}
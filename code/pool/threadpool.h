@@ -2,67 +2,289 @@
 #ifndef _THREADPOOL_H_
 #define _THREADPOOL_H_
 #include <mutex>
-#include <queue>
-#include <functional>
-#include <condition_variable>
+#include <vector>
+#include <atomic>
+#include <memory>
 #include <thread>
 #include <assert.h>
+#include <stdint.h>
 
+#include "task.h"
+#include "workdeque.h"
+#include "mpmcqueue.h"
 
-// 线程池
+
+// 工作窃取线程池
+// 每个工作线程有自己的无锁双端队列, 工作线程里提交的任务放进自己的队列;
+// 其它线程(Reactor)提交的任务放进公共的无锁提交队列, 工作线程从中成批取走, 多出来的放进自己的队列供别人窃取
+// 没有任务时先自旋一段时间, 依次检查自己的队列、提交队列和别人的队列, 仍然没有才在 futex 上睡眠
+// 只有确实有线程在睡眠时, 提交任务才会发起唤醒的系统调用
+// 任务用 Task 保存, 节点从线程本地的空闲链表里取, 稳定运行时提交和执行任务都不分配内存
+// 带 key 提交的任务(同一个连接的读写)放进 key 对应的工作线程自己的收件队列, 由它执行, 连接的数据一直在它的缓存里;
+// 只有收件队列积压、或者它阻塞在 BlockingScope 里时, 别的线程才去窃取
+// 线程数在 [minThreads, maxThreads] 之间伸缩: 任务从提交到开始执行等得太久而没有空闲线程,
+// 或者所有线程都阻塞在 BlockingScope 里(数据库查询)而还有任务排队时补充线程; 空闲超过 idleTimeoutMs 的线程退出
+// 按 CoDel 的方法记录任务的排队时间: 一个窗口内最小的排队时间都超过 SHED_TARGET_NS, 说明队列一直排着,
+// 而线程已经补充到上限, overloaded() 返回 true, 调用方应该直接拒绝新请求, 而不是让它们排在后面等到超时
+// 析构时等所有已提交的任务执行完, 并 join 全部线程
 class ThreadPool {
 public:
-    explicit ThreadPool(size_t threadCount = 8): pool_(std::make_shared<Pool>()) {
-        assert(threadCount > 0);
-        for (size_t i = 0; i < threadCount; i++) {
-            std::thread([pool = pool_] {
-                // 判断是否有任务, 有的话就执行, 否则等待任务
-                std::unique_lock<std::mutex> locker(pool->mtx);
-                while (true) {
-                    if (!pool->tasks.empty()) {
-                        auto task = pool->tasks.front();
-                        pool->tasks.pop();
-                        locker.unlock();
-                        task();
-                        locker.lock();
-                    } else if (pool->isClosed) {
-                        break;
-                    } else {
-                        pool->cond.wait(locker);
-                    }
-                }
-            }).detach();
-        }
-    }
+    // 固定线程数
+    explicit ThreadPool(size_t threadCount = 8);
 
-    ~ThreadPool() {
-        if (pool_) {
-            {
-                std::lock_guard<std::mutex> locker(pool_->mtx);
-                pool_->isClosed = true;
-            }
-            pool_->cond.notify_all();
-        }
-    }
+    // cpus 不为空时, 第 i 个槽位上的线程绑定到 cpus[i % cpus.size()]
+    ThreadPool(size_t minThreads, size_t maxThreads, int idleTimeoutMs = IDLE_TIMEOUT_MS,
+               std::vector<int> cpus = {});
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
 
     template <typename F>
     void AddTask(F&& task) {
-        {
-            std::lock_guard<std::mutex> locker(pool_->mtx);
-            pool_->tasks.emplace(std::forward<F>(task));
+        TaskNode* node = AllocNode_();
+        node->task = Task(std::forward<F>(task));
+        pool_->submit(node);
+    }
+
+    // key 相同的任务交给同一个工作线程; key 对应的线程已经退出时和 AddTask(task) 一样
+    template <typename F>
+    void AddTask(size_t key, F&& task) {
+        TaskNode* node = AllocNode_();
+        node->task = Task(std::forward<F>(task));
+        int home = pool_->homeOf(key);
+        if (home < 0 || !pool_->pushHome(node, home)) {
+            pool_->submit(node);
+            return;
         }
-        pool_->cond.notify_one();
+        pool_->wakeHome(home);
     }
 
-    
+    class Batch;
+
+    class BlockingScope;
+
+    // 当前的线程数
+    size_t threadCount() const;
+
+    // 上一个窗口里任务的最小排队时间超过 SHED_TARGET_NS, 并且线程数已经到上限
+    bool overloaded() const;
+
+    // 空闲线程多久没有任务后退出, 线程数不低于 minThreads
+    static constexpr int IDLE_TIMEOUT_MS = 30000;
+    // 可以接受的排队时间, 和统计最小排队时间的窗口长度
+    static constexpr int64_t SHED_TARGET_NS = 5000000;
+    static constexpr int64_t SHED_INTERVAL_NS = 100000000;
+
 private:
+    // 队列里放的是节点指针, 提交队列直接用 next 串起来
+    struct TaskNode {
+        Task task;
+        TaskNode* next = nullptr;
+        // 提交时间(steady_clock 纳秒), 用来计算排队时间
+        int64_t enqueueNs = 0;
+    };
+
+    // 执行完的节点放回当前线程的空闲链表, 攒多了成批交给公共链表, 由提交任务的线程成批取走
+    struct NodeCache;
+    static TaskNode* AllocNode_();
+    static void FreeNode_(TaskNode* node);
+
+    static constexpr size_t INBOX_CAPACITY = 1024;
+    // 收件队列里至少有这么多任务才算积压
+    static constexpr size_t INBOX_STEAL_MIN = 2;
+    // 所属线程当前的任务执行超过这个时间, 收件队列里只有一个任务也可以窃取
+    static constexpr int64_t INBOX_STEAL_DELAY_NS = 500000;
+
+    // 按 maxThreads 预先分配, 窃取时遍历的数组不会变; 线程退出后槽位留给以后补充的线程
+    struct Worker {
+        WorkDeque<TaskNode> deque;
+        // 指定给这个线程的任务
+        MpmcQueue<TaskNode, INBOX_CAPACITY> inbox;
+        std::thread thread;
+        // 每个线程一个 eventcount, 可以只唤醒指定的线程: 睡眠前记下 epoch, 唤醒方先增加 epoch
+        std::atomic<uint32_t> epoch{0};
+        std::atomic<bool> sleeping{false};
+        // 这个线程正在 BlockingScope 里
+        std::atomic<bool> blocking{false};
+        // 当前任务开始执行的时间, 没有在执行任务时为 0
+        std::atomic<int64_t> busySinceNs{0};
+        // 有线程在使用这个槽位, 只在 spawnMtx 里修改
+        std::atomic<bool> active{false};
+    };
+
     struct Pool {
-        std::mutex mtx;
-        std::condition_variable cond;
-        bool isClosed;
-        std::queue<std::function<void()>> tasks;
+        ~Pool();
+
+        // 启动一个线程, 已经到 maxThreads 或者已关闭时返回 false
+        bool spawn();
+
+        // 排队太久或线程都被阻塞时补充线程, 两次补充至少间隔 GROW_INTERVAL_NS
+        void grow(int64_t now);
+
+        // 空闲太久的线程退出, 返回 false 表示不能退出(已经是 minThreads)
+        bool retire(int idx);
+
+        void submit(TaskNode* node);
+
+        void submitBatch(TaskNode* const* nodes, size_t n);
+
+        // 放进各自的收件队列, 放不下的追加到 rest 里由调用方按普通任务提交; 每个线程最多唤醒一次
+        void submitHomed(const std::pair<TaskNode*, int>* nodes, size_t n, std::vector<TaskNode*>* rest);
+
+        // 提交队列满了时放进溢出链表
+        void pushOverflow(TaskNode* const* nodes, size_t n);
+
+        void run(int idx);
+
+        // 依次从自己的队列、提交队列、别人的队列取任务, 都没有返回 nullptr
+        TaskNode* find(int idx, uint32_t* seed, uint32_t tick);
+
+        TaskNode* pollInject(int idx);
+
+        TaskNode* steal(int idx, uint32_t* seed);
+
+        // idx 为 -1 时不看自己的收件队列
+        bool hasWork(int idx) const;
+
+        // 别的线程可以从 victim 的收件队列窃取: 积压了, 或者所属线程阻塞着/一个任务执行太久/已经退出
+        bool canStealInbox(int victim) const;
+
+        // 有线程在睡眠时最多唤醒 n 个
+        void wake(int n);
+
+        void wakeWorker(int idx);
+
+        // key 对应的工作线程, 从 key % 槽位数开始找第一个有线程的槽位, 都没有返回 -1
+        int homeOf(size_t key) const;
+
+        // 放进 home 的收件队列, 满了返回 false; 不唤醒
+        bool pushHome(TaskNode* node, int home);
+
+        // home 在睡眠时唤醒它; home 忙不过来时再唤醒一个别的线程来窃取
+        void wakeHome(int home);
+
+        // 返回 false 表示等待超时
+        bool park(int idx, bool timed);
+
+        // 记录一个任务的排队时间, 线程没有任务可做时记为 0; 窗口结束时更新 overloaded
+        void observeDelay(int64_t delayNs, int64_t now);
+
+        std::vector<std::unique_ptr<Worker>> workers;
+
+        // 提交队列
+        MpmcQueue<TaskNode> inject;
+
+        // 提交队列满了之后的任务用节点的 next 串成单链表, 不为空时新任务也排在这里, 保持先后顺序
+        std::mutex overflowMtx;
+        TaskNode* overflowHead = nullptr;
+        TaskNode* overflowTail = nullptr;
+        // 不加锁判断溢出链表是否为空
+        std::atomic<size_t> overflowSize{0};
+
+        // 正在睡眠或准备睡眠的线程数, 为 0 时提交任务不用唤醒
+        std::atomic<int> idle{0};
+        // 唤醒时从这里开始找睡眠的线程, 不总是唤醒同一个
+        std::atomic<uint32_t> wakeCursor{0};
+        std::atomic<bool> isClosed{false};
+
+        size_t minThreads = 1;
+        size_t maxThreads = 1;
+        int idleTimeoutMs = IDLE_TIMEOUT_MS;
+        std::vector<int> cpus;
+        std::mutex spawnMtx;
+        std::atomic<size_t> threads{0};
+        // 正在 BlockingScope 里的线程数
+        std::atomic<size_t> blocked{0};
+        std::atomic<int64_t> lastGrowNs{0};
+        // 从上次检查以来出现过所有线程都在忙的情况, 这段时间不收缩
+        std::atomic<bool> saturated{false};
+        // 上次发现线程池忙或者退出一个线程的时间, 受 spawnMtx 保护
+        int64_t lastBusyNs = 0;
+
+        // 当前窗口的开始时间和窗口内的最小排队时间, 每个任务开始时都会读, 单独放一个缓存行
+        alignas(64) std::atomic<int64_t> delayWindowNs{0};
+        std::atomic<int64_t> minDelayNs{INT64_MAX};
+        std::atomic<bool> overloaded{false};
     };
+
+    // 任务排队超过这个时间并且没有空闲线程时补充线程
+    static constexpr int64_t GROW_DELAY_NS = 2000000;
+    static constexpr int64_t GROW_INTERVAL_NS = 1000000;
+
+    // 没有任务时重试的次数, 超过后睡眠
+    static constexpr int SPIN_ROUNDS = 64;
+    // 线程本地和公共空闲链表之间一次交换的节点数
+    static constexpr size_t NODE_BATCH = 64;
+    // 一次最多从提交队列取走的任务数
+    static constexpr size_t INJECT_BATCH = 32;
+    // 每执行这么多个任务先看一次提交队列, 防止只处理本地队列时提交队列里的任务等太久
+    static constexpr uint32_t INJECT_INTERVAL = 61;
+
+    std::shared_ptr<Pool> pool_;
+};
+
+// 任务里要做可能长时间阻塞的操作(数据库查询)时在栈上放一个;
+// 线程池里的线程都阻塞着而还有任务排队时, 不等排队超时直接补充线程. 不在线程池线程里时什么都不做
+class ThreadPool::BlockingScope {
+public:
+    BlockingScope();
+
+    ~BlockingScope();
+
+    BlockingScope(const BlockingScope&) = delete;
+    BlockingScope& operator=(const BlockingScope&) = delete;
+
+private:
+    Pool* pool_;
+};
+
+// 攒起来一次提交的一批任务: Reactor 把一轮 epoll_wait 产生的任务一次放进提交队列, 只唤醒一次
+// 只能在一个线程里使用, 析构时提交剩下的任务
+class ThreadPool::Batch {
+public:
+    explicit Batch(ThreadPool& pool): pool_(pool.pool_) {}
+
+    ~Batch() { submit(); }
+
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+
+    template <typename F>
+    void add(F&& task) {
+        TaskNode* node = AllocNode_();
+        node->task = Task(std::forward<F>(task));
+        nodes_.push_back(node);
+    }
+
+    // 同 ThreadPool::AddTask(key, task)
+    template <typename F>
+    void add(size_t key, F&& task) {
+        TaskNode* node = AllocNode_();
+        node->task = Task(std::forward<F>(task));
+        int home = pool_->homeOf(key);
+        if (home < 0) nodes_.push_back(node);
+        else homed_.emplace_back(node, home);
+    }
+
+    void submit() {
+        if (!homed_.empty()) {
+            pool_->submitHomed(homed_.data(), homed_.size(), &nodes_);
+            homed_.clear();
+        }
+        if (nodes_.empty()) return;
+        pool_->submitBatch(nodes_.data(), nodes_.size());
+        // 保留容量, 稳定运行时不再分配
+        nodes_.clear();
+    }
+
+    size_t size() const { return nodes_.size() + homed_.size(); }
+
+private:
     std::shared_ptr<Pool> pool_;
+    std::vector<TaskNode*> nodes_;
+    std::vector<std::pair<TaskNode*, int>> homed_;
 };
 
 #endif
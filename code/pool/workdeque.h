@@ -0,0 +1,86 @@
+#ifndef _WORKDEQUE_H_
+#define _WORKDEQUE_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+
+// 固定容量的 Chase-Lev 工作窃取双端队列, 元素是指针
+// 只有所属线程能 push/pop, 从底部进出(后进先出, 缓存更热); 其它线程用 steal 从顶部拿走最早的元素
+// 容量固定就不需要扩容和回收旧数组, push 满了返回 false, 由调用方放到别处
+template <typename T>
+class WorkDeque {
+public:
+    static const size_t CAPACITY = 256;
+
+    WorkDeque(): top_(0), bottom_(0) {
+        for (auto& slot : slots_) slot.store(nullptr, std::memory_order_relaxed);
+    }
+
+    WorkDeque(const WorkDeque&) = delete;
+    WorkDeque& operator=(const WorkDeque&) = delete;
+
+    // 只能由所属线程调用
+    bool push(T* item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        // t 可能是旧值, 只会偏小, 所以不会覆盖还没被窃取走的槽
+        if (b - t >= static_cast<int64_t>(CAPACITY)) return false;
+        slots_[b & MASK].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 只能由所属线程调用, 空时返回 nullptr
+    T* pop() {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        T* item = nullptr;
+        if (t <= b) {
+            item = slots_[b & MASK].load(std::memory_order_relaxed);
+            if (t == b) {
+                // 最后一个元素, 和窃取者竞争
+                if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    item = nullptr;
+                }
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // 任意线程调用, 空或者和别人竞争失败时返回 nullptr
+    T* steal() {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+        T* item = slots_[t & MASK].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    // 近似值, 只用于判断是否值得去窃取
+    bool empty() const {
+        return bottom_.load(std::memory_order_relaxed) <= top_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const size_t MASK = CAPACITY - 1;
+    static_assert((CAPACITY & MASK) == 0, "CAPACITY must be a power of 2");
+
+    // top_ 被窃取者频繁修改, 和 bottom_ 放在不同的缓存行
+    alignas(64) std::atomic<int64_t> top_;
+    alignas(64) std::atomic<int64_t> bottom_;
+    alignas(64) std::atomic<T*> slots_[CAPACITY];
+};
+
+#endif
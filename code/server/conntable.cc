@@ -0,0 +1,34 @@
+#include "conntable.h"
+
+using namespace std;
+
+ConnTable::ConnTable(int maxFd): capacity_(maxFd), chunks_((maxFd + CHUNK_SIZE - 1) >> CHUNK_BITS) {
+    assert(maxFd > 0);
+}
+
+HttpConn* ConnTable::acquire(int fd, const sockaddr_in& addr) {
+    assert(fd >= 0 && static_cast<size_t>(fd) < capacity_);
+    unique_ptr<HttpConn[]>& chunk = chunks_[fd >> CHUNK_BITS];
+    if (!chunk) {
+        chunk = make_unique<HttpConn[]>(CHUNK_SIZE);
+    }
+    HttpConn* client = &chunk[fd & CHUNK_MASK];
+    client->init(fd, addr);
+    return client;
+}
+
+HttpConn* ConnTable::get(int fd) const {
+    if (fd < 0 || static_cast<size_t>(fd) >= capacity_) return nullptr;
+    const unique_ptr<HttpConn[]>& chunk = chunks_[fd >> CHUNK_BITS];
+    if (!chunk) return nullptr;
+    HttpConn* client = &chunk[fd & CHUNK_MASK];
+    // generation 从 0 开始, init 之后才不为 0, 为 0 说明这个槽位还没有连接用过
+    if (client->getGeneration() == 0) return nullptr;
+    return client;
+}
+
+HttpConn* ConnTable::get(int fd, uint32_t generation) const {
+    HttpConn* client = get(fd);
+    if (!client || client->isClosed() || client->getGeneration() != generation) return nullptr;
+    return client;
+}
@@ -0,0 +1,41 @@
+#ifndef _CONNTABLE_H_
+#define _CONNTABLE_H_
+
+#include <vector>
+#include <memory>
+#include <assert.h>
+
+#include "../http/httpconn.h"
+
+// 按 fd 下标索引的连接表, 代替 unordered_map<int, HttpConn>
+// HttpConn 按 CHUNK_SIZE 个一块连续分配, 块在其中第一个 fd 被使用时分配, 之后一直复用,
+// HttpConn 的地址在整个生命周期内不变. epoll 事件、计时器和任务里存的是 fd + generation,
+// 用 get(fd, generation) 找回连接
+class ConnTable {
+public:
+    explicit ConnTable(int maxFd);
+
+    ~ConnTable() = default;
+
+    // 为新连接取出 fd 对应的槽位, 并递增其 generation
+    HttpConn* acquire(int fd, const sockaddr_in& addr);
+
+    // fd 对应的连接, 槽位还没用过时返回 nullptr
+    HttpConn* get(int fd) const;
+
+    // 连接已关闭, 或 generation 不一致(fd 已经被新连接复用)时返回 nullptr
+    HttpConn* get(int fd, uint32_t generation) const;
+
+    size_t capacity() const { return capacity_; }
+
+private:
+    static constexpr int CHUNK_BITS = 6;
+    static constexpr int CHUNK_SIZE = 1 << CHUNK_BITS;
+    static constexpr int CHUNK_MASK = CHUNK_SIZE - 1;
+
+    size_t capacity_;
+    // 每块 CHUNK_SIZE 个相邻 fd 的连接, 没用过的块为空
+    std::vector<std::unique_ptr<HttpConn[]>> chunks_;
+};
+
+#endif
@@ -26,6 +26,22 @@ bool Epoller::modFd(int fd, uint32_t events) {
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
 }
 
+bool Epoller::addFd(int fd, uint32_t events, uint64_t data) {
+    if (fd < 0) return false;
+    epoll_event ev = {0};
+    ev.data.u64 = data;
+    ev.events = events;
+    return 0 == epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+}
+
+bool Epoller::modFd(int fd, uint32_t events, uint64_t data) {
+    if (fd < 0) return false;
+    epoll_event ev = {0};
+    ev.data.u64 = data;
+    ev.events = events;
+    return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
+}
+
 bool Epoller::delFd(int fd) {
     if (fd < 0) return false;
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
@@ -40,6 +56,11 @@ int Epoller::getEventFd(size_t i) const {
     return events_[i].data.fd;
 }
 
+uint64_t Epoller::getEventData(size_t i) const {
+    assert(i < events_.size() && i >= 0);
+    return events_[i].data.u64;
+}
+
 uint32_t Epoller::getEvents(size_t i) const {
     assert(i < events_.size() && i >= 0);
     return events_[i].events;
@@ -7,6 +7,7 @@
 #include <assert.h> // close()
 #include <vector>
 #include <errno.h>
+#include <stdint.h>
 
 class Epoller {
 public:
@@ -16,14 +17,21 @@ public:
 
     bool addFd(int fd, uint32_t events);
 
+    // 把 data 存进 epoll_event.data.u64, 事件返回时直接取出; 低 32 位应当是 fd, getEventFd 仍然可用
+    bool addFd(int fd, uint32_t events, uint64_t data);
+
     bool modFd(int fd, uint32_t events);
 
+    bool modFd(int fd, uint32_t events, uint64_t data);
+
     bool delFd(int fd);
 
     int wait(int timeoutMs = -1);
 
     int getEventFd(size_t i) const;
 
+    uint64_t getEventData(size_t i) const;
+
     uint32_t getEvents(size_t i) const;
         
 private:
@@ -0,0 +1,282 @@
+#include "uring.h"
+#include <signal.h>
+#include <string.h>
+
+using namespace std;
+
+Uring::Uring(unsigned entries): ringFd_(-1), sqHead_(nullptr), sqTail_(nullptr), sqMask_(0),
+    sqEntries_(0), sqes_(nullptr), sqeTail_(0), cqHead_(nullptr), cqTail_(nullptr), cqMask_(0),
+    cqes_(nullptr), sqRing_(MAP_FAILED), sqRingSize_(0), cqRing_(MAP_FAILED), cqRingSize_(0),
+    sqesSize_(0), bufRing_(nullptr), bufBase_(nullptr), bufMapSize_(0), bufSize_(0), bufMask_(0), bufTail_(0) {
+    assert(entries > 0);
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd_ = syscall(__NR_io_uring_setup, entries, &params);
+    if (ringFd_ < 0) return;
+    // 带超时的等待需要 IORING_FEAT_EXT_ARG (5.11+)
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        release_();
+        return;
+    }
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sqRingSize_ = cqRingSize_ = max(sqRingSize_, cqRingSize_);
+    }
+    sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ringFd_, IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ringFd_, IORING_OFF_CQ_RING);
+    }
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ringFd_, IORING_OFF_SQES);
+    if (sqRing_ == MAP_FAILED || cqRing_ == MAP_FAILED || sqes == MAP_FAILED) {
+        if (sqes != MAP_FAILED) munmap(sqes, sqesSize_);
+        release_();
+        return;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqEntries_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+    sqeTail_ = *sqTail_;
+    // SQ 索引数组固定为恒等映射, 之后只需要推进 tail
+    unsigned* sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sqEntries_; i++) {
+        sqArray[i] = i;
+    }
+
+    char* cq = static_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    events_.resize(params.cq_entries);
+}
+
+Uring::~Uring() {
+    release_();
+}
+
+void Uring::release_() {
+    if (sqes_) munmap(sqes_, sqesSize_);
+    if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_) munmap(cqRing_, cqRingSize_);
+    if (sqRing_ != MAP_FAILED) munmap(sqRing_, sqRingSize_);
+    sqes_ = nullptr;
+    sqRing_ = cqRing_ = MAP_FAILED;
+    if (ringFd_ >= 0) close(ringFd_);
+    ringFd_ = -1;
+    // 关闭 ring 之后内核不再使用缓冲区组
+    if (bufRing_) munmap(bufRing_, bufMapSize_);
+    bufRing_ = nullptr;
+    bufBase_ = nullptr;
+}
+
+io_uring_sqe* Uring::getSqe_() {
+    assert(isOpen());
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if (sqeTail_ - head >= sqEntries_) {
+        // SQ 满了, 先提交一批
+        unsigned toSubmit = flushSq_();
+        if (enter_(toSubmit, 0, 0, nullptr, 0) < 0) return nullptr;
+        head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        if (sqeTail_ - head >= sqEntries_) return nullptr;
+    }
+    io_uring_sqe* sqe = &sqes_[sqeTail_ & sqMask_];
+    sqeTail_++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+unsigned Uring::flushSq_() {
+    unsigned published = *sqTail_;
+    if (published != sqeTail_) {
+        __atomic_store_n(sqTail_, sqeTail_, __ATOMIC_RELEASE);
+    }
+    return sqeTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+}
+
+int Uring::enter_(unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argSize) {
+    int ret = syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete, flags, arg, argSize);
+    return ret < 0 ? -errno : ret;
+}
+
+bool Uring::prepAccept(int listenFd, uint64_t userData) {
+    io_uring_sqe* sqe = getSqe_();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenFd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool Uring::prepRecv(int fd, void* buf, size_t len, uint64_t userData) {
+    io_uring_sqe* sqe = getSqe_();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->user_data = userData;
+    return true;
+}
+
+bool Uring::setupBufRing(unsigned entries, unsigned bufSize) {
+    assert(isOpen() && !bufRing_);
+    assert(entries > 0 && (entries & (entries - 1)) == 0 && entries <= 32768);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t ringSize = (entries * sizeof(io_uring_buf) + pageSize - 1) / pageSize * pageSize;
+    size_t mapSize = ringSize + static_cast<size_t>(entries) * bufSize;
+    void* mem = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (mem == MAP_FAILED) return false;
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(mem);
+    reg.ring_entries = entries;
+    reg.bgid = BUF_GROUP;
+    if (syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(mem, mapSize);
+        return false;
+    }
+    bufRing_ = static_cast<io_uring_buf_ring*>(mem);
+    bufBase_ = static_cast<char*>(mem) + ringSize;
+    bufMapSize_ = mapSize;
+    bufSize_ = bufSize;
+    bufMask_ = entries - 1;
+    bufTail_ = 0;
+    for (unsigned bid = 0; bid < entries; bid++) {
+        io_uring_buf* buf = bufAt_(bid);
+        buf->addr = reinterpret_cast<uint64_t>(bufBase_ + static_cast<size_t>(bid) * bufSize_);
+        buf->len = bufSize_;
+        buf->bid = static_cast<uint16_t>(bid);
+        bufTail_++;
+    }
+    __atomic_store_n(&bufRing_->tail, bufTail_, __ATOMIC_RELEASE);
+    return true;
+}
+
+io_uring_buf* Uring::bufAt_(unsigned idx) const {
+    // 头文件里 bufs 前面的空结构体在 C++ 里占 1 字节, bufs 的偏移变成了 8, 不能直接用, 按环的起始地址算
+    return reinterpret_cast<io_uring_buf*>(bufRing_) + idx;
+}
+
+bool Uring::prepRecvMultishot(int fd, uint64_t userData) {
+    assert(bufRing_);
+    io_uring_sqe* sqe = getSqe_();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool Uring::prepRead(int fd, void* buf, size_t len, uint64_t userData) {
+    io_uring_sqe* sqe = getSqe_();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(len);
+    // 文件偏移, eventfd 忽略
+    sqe->off = 0;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool Uring::prepWritev(int fd, const iovec* iov, int iovCnt, uint64_t userData) {
+    io_uring_sqe* sqe = getSqe_();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(iov);
+    sqe->len = static_cast<uint32_t>(iovCnt);
+    sqe->user_data = userData;
+    return true;
+}
+
+bool Uring::prepClose(int fd, uint64_t userData) {
+    io_uring_sqe* sqe = getSqe_();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = userData;
+    return true;
+}
+
+int Uring::wait(int timeoutMs) {
+    unsigned toSubmit = flushSq_();
+    unsigned head = *cqHead_;
+    // 已经有完成事件时只提交不等待
+    bool ready = head != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    if (toSubmit > 0 || !ready) {
+        unsigned minComplete = ready ? 0 : 1;
+        int ret = 0;
+        if (timeoutMs < 0) {
+            ret = enter_(toSubmit, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0);
+        } else {
+            __kernel_timespec ts = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000LL };
+            io_uring_getevents_arg arg = { 0, _NSIG / 8, 0, reinterpret_cast<uint64_t>(&ts) };
+            unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+            ret = enter_(toSubmit, minComplete, flags, &arg, sizeof(arg));
+        }
+        if (ret < 0 && ret != -ETIME && ret != -EINTR && ret != -EBUSY) {
+            errno = -ret;
+            return -1;
+        }
+    }
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    int n = 0;
+    while (head != tail && static_cast<size_t>(n) < events_.size()) {
+        events_[n++] = cqes_[head & cqMask_];
+        head++;
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+uint64_t Uring::getUserData(size_t i) const {
+    assert(i < events_.size());
+    return events_[i].user_data;
+}
+
+int Uring::getResult(size_t i) const {
+    assert(i < events_.size());
+    return events_[i].res;
+}
+
+uint32_t Uring::getFlags(size_t i) const {
+    assert(i < events_.size());
+    return events_[i].flags;
+}
+
+const char* Uring::getBuffer(size_t i) const {
+    assert(i < events_.size());
+    if (!bufRing_ || !(events_[i].flags & IORING_CQE_F_BUFFER)) return nullptr;
+    uint16_t bid = events_[i].flags >> IORING_CQE_BUFFER_SHIFT;
+    return bufBase_ + static_cast<size_t>(bid) * bufSize_;
+}
+
+void Uring::recycleBuffer(size_t i) {
+    assert(i < events_.size());
+    if (!bufRing_ || !(events_[i].flags & IORING_CQE_F_BUFFER)) return;
+    uint16_t bid = events_[i].flags >> IORING_CQE_BUFFER_SHIFT;
+    io_uring_buf* buf = bufAt_(bufTail_ & bufMask_);
+    buf->addr = reinterpret_cast<uint64_t>(bufBase_ + static_cast<size_t>(bid) * bufSize_);
+    buf->len = bufSize_;
+    buf->bid = bid;
+    bufTail_++;
+    __atomic_store_n(&bufRing_->tail, bufTail_, __ATOMIC_RELEASE);
+}
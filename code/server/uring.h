@@ -0,0 +1,109 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/syscall.h> // io_uring_setup, io_uring_enter
+#include <sys/mman.h>    // mmap()
+#include <sys/uio.h>     // iovec
+#include <unistd.h>      // close()
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+#include <errno.h>
+
+// io_uring 后端, 接口仿照 Epoller: prep 系列只填 SQE, wait 时一次性提交并收割 CQE
+// 直接使用系统调用, 不依赖 liburing
+class Uring {
+public:
+    explicit Uring(unsigned entries = 1024);
+
+    ~Uring();
+
+    bool isOpen() const { return ringFd_ >= 0; }
+
+    // 多路 accept, 一个 SQE 持续产生 CQE, 直到 CQE 不带 IORING_CQE_F_MORE
+    bool prepAccept(int listenFd, uint64_t userData);
+
+    bool prepRecv(int fd, void* buf, size_t len, uint64_t userData);
+
+    // 注册一组由内核挑选的接收缓冲区 (provided buffer ring, 5.19+), entries 是 2 的幂
+    // 失败时返回 false, 只能用 prepRecv
+    bool setupBufRing(unsigned entries, unsigned bufSize);
+
+    bool hasBufRing() const { return bufRing_ != nullptr; }
+
+    // 多路 recv (6.0+), 每收到一段数据产生一个 CQE, 数据在内核从缓冲区组里取的缓冲区里,
+    // 直到 CQE 不带 IORING_CQE_F_MORE; 内核不支持时 CQE 返回 -EINVAL
+    bool prepRecvMultishot(int fd, uint64_t userData);
+
+    // 普通 read, 用于 eventfd 这类不是套接字的 fd
+    bool prepRead(int fd, void* buf, size_t len, uint64_t userData);
+
+    // iov 在 CQE 返回前必须保持有效
+    bool prepWritev(int fd, const iovec* iov, int iovCnt, uint64_t userData);
+
+    bool prepClose(int fd, uint64_t userData);
+
+    // 提交所有未提交的 SQE, 至少等待一个 CQE, 返回收割到的 CQE 数量
+    int wait(int timeoutMs = -1);
+
+    uint64_t getUserData(size_t i) const;
+
+    int getResult(size_t i) const;
+
+    uint32_t getFlags(size_t i) const;
+
+    // 第 i 个 CQE 带的缓冲区, 没有时返回 nullptr; 用完后 recycleBuffer 还给内核
+    const char* getBuffer(size_t i) const;
+
+    void recycleBuffer(size_t i);
+
+private:
+    void release_();
+
+    io_uring_sqe* getSqe_();
+
+    // 把本地的 sqTail 发布给内核, 返回待提交数量
+    unsigned flushSq_();
+
+    // 缓冲区环的第 idx 项
+    io_uring_buf* bufAt_(unsigned idx) const;
+
+    int enter_(unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argSize);
+
+    int ringFd_;
+
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned sqMask_;
+    unsigned sqEntries_;
+    io_uring_sqe* sqes_;
+    // 已填写但尚未发布给内核的尾部
+    unsigned sqeTail_;
+
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned cqMask_;
+    io_uring_cqe* cqes_;
+
+    void* sqRing_;
+    size_t sqRingSize_;
+    void* cqRing_;
+    size_t cqRingSize_;
+    size_t sqesSize_;
+
+    std::vector<io_uring_cqe> events_;
+
+    // 缓冲区组, 环和缓冲区在同一块映射里, 环在前面
+    static const uint16_t BUF_GROUP = 0;
+    io_uring_buf_ring* bufRing_;
+    char* bufBase_;
+    size_t bufMapSize_;
+    unsigned bufSize_;
+    unsigned bufMask_;
+    // 本地的环尾部, 还回缓冲区后发布给内核
+    uint16_t bufTail_;
+};
+
+#endif
@@ -1,16 +1,28 @@
 #include "webserver.h"
+#include <sys/eventfd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <algorithm>
+#include <cstring>
 
 using namespace std;
 
+const char WebServer::SHED_RESPONSE[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Length: 0\r\n"
+    "Retry-After: 1\r\n"
+    "Connection: close\r\n\r\n";
 
 
 WebServer::WebServer(
     int port, int trigMode, int timeoutMS, bool optLinger, 
     int sqlPort, const std::string& sqlUser, const std::string& sqlPwd, 
     const std::string& dbName, int connPoolNum, int threadNum,
-    bool openLog, Log::LogLevel logLevel, int logQueSize): 
+    bool openLog, Log::LogLevel logLevel, int logQueSize, int reactorNum, bool useUring,
+    bool pinCpu, bool incomingCpu, bool connAffinity):
     port_(port), openLinger_(optLinger), timeoutMS_(timeoutMS), isClose_(false),
-    timer_(new HeapTimer()), threadpool_(new ThreadPool()), epoller_(new Epoller()) {
+    reusePort_(reactorNum > 0), incomingCpu_(incomingCpu), connAffinity_(connAffinity) {
     if (openLog) {
         Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
     }
@@ -24,32 +36,97 @@ WebServer::WebServer(
     srcDir_ += "/resources";
     HttpConn::userCount = 0;
     HttpConn::srcDir = srcDir_;
+    HttpResponse::LoadErrorPages(srcDir_);
     SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
     
     initEventMode_(trigMode);
-    if (!initSocket_()) {
-        isClose_ = true;
+    if (useUring) {
+        // io_uring 没有 sendfile 操作, 大文件也映射后用 writev 发送
+        FileCache::Instance()->setSendfileThreshold(SIZE_MAX);
+    }
+    int loopNum = reactorNum > 0 ? reactorNum : 1;
+    std::vector<int> reactorCpus, workerCpus;
+    cpu_set_t oldSet;
+    bool restoreAffinity = false;
+    if (pinCpu) {
+        PlanCpus_(loopNum, &reactorCpus, &workerCpus);
+        restoreAffinity = sched_getaffinity(0, sizeof(oldSet), &oldSet) == 0;
+    }
+    // threadNum 和数据库连接数是上限, 空闲时分别收缩到一半和 1 个线程; SQL 线程大多在等数据库, 不绑定
+    if (reactorNum <= 0 && !useUring) {
+        threadpool_ = std::make_unique<ThreadPool>(max(threadNum / 2, 1), max(threadNum, 1),
+                                                   ThreadPool::IDLE_TIMEOUT_MS, workerCpus);
+    }
+    sqlpool_ = std::make_unique<ThreadPool>(1, max(connPoolNum, 1));
+    for (int i = 0; i < loopNum && !isClose_; i++) {
+        int cpu = reactorCpus.empty() ? -1 : reactorCpus[i];
+        // 临时绑定到 Reactor 的 CPU 上构造, 连接表、计时器、io_uring 队列按首次访问分配在那个 NUMA 节点上
+        if (cpu >= 0) PinThread_(cpu);
+        auto reactor = std::make_unique<Reactor>();
+        reactor->server = this;
+        reactor->cpu = cpu;
+        reactor->epoller = std::make_unique<Epoller>();
+        reactor->timer = std::make_unique<TimeWheel>();
+        if (threadpool_) {
+            reactor->tasks = std::make_unique<ThreadPool::Batch>(*threadpool_);
+        }
+        if (useUring) {
+            reactor->uring = std::make_unique<Uring>();
+            reactor->uringState.assign(MAX_FD, 0);
+            if (!reactor->uring->isOpen()) {
+                Log_Error("io_uring setup error!");
+                isClose_ = true;
+            } else {
+                reactor->multishotRecv = reactor->uring->setupBufRing(URING_BUF_ENTRIES, URING_BUF_SIZE);
+                if (!reactor->multishotRecv) Log_Warn("io_uring buffer ring unsupported, use single-shot recv");
+            }
+        }
+        if (!isClose_ && (!initSocket_(reactor.get()) || !initNotify_(reactor.get()))) {
+            isClose_ = true;
+        }
+        reactors_.push_back(std::move(reactor));
+    }
+    if (restoreAffinity) {
+        sched_setaffinity(0, sizeof(oldSet), &oldSet);
     }
     if (openLog) {
         if (isClose_) Log_Error("========== Server init error!==========");
         else {
             Log_Info("========== Server init ==========");
             Log_Info("Port:%d, OpenLinger: %s", port_, optLinger ? "true": "false");
-            Log_Info("listenFd: %d", listenFd_);
+            Log_Info("Reactor num: %d, ReusePort: %s, IO: %s", loopNum,
+                            reusePort_ ? "true": "false", useUring ? "io_uring": "epoll");
             Log_Info("Listen Mode: %s, OpenConn Mode: %s",
                             (listenEvent_ & EPOLLET ? "ET": "LT"),
                             (connEvent_ & EPOLLET ? "ET": "LT"));
             Log_Info("LogSys level: %d", logLevel);
             Log_Info("srcDir: %s", HttpConn::srcDir.c_str());
-            Log_Info("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            Log_Info("FileCache capacity: %zu, sendfile threshold: %zu",
+                            FileCache::Instance()->capacity(), FileCache::Instance()->sendfileThreshold());
+            Log_Info("HttpScan kernel: %s", HttpScan::GetLevelName());
+            std::string cpus;
+            for (int cpu : reactorCpus) cpus += (cpus.empty() ? "" : ",") + to_string(cpu);
+            Log_Info("Reactor CPUs: %s, ThreadPool CPUs: %zu, SO_INCOMING_CPU: %s", cpus.empty() ? "none" : cpus.c_str(),
+                            threadpool_ ? workerCpus.size() : 0, incomingCpu_ && reusePort_ && pinCpu ? "true" : "false");
+            Log_Info("Connection affinity: %s", threadpool_ && connAffinity_ ? "true" : "false");
+            Log_Info("SqlConnPool num: %d, ThreadPool num: %d-%d, SQL ThreadPool num: 1-%d", connPoolNum,
+                            threadpool_ ? max(threadNum / 2, 1) : 0, threadpool_ ? max(threadNum, 1) : 0, max(connPoolNum, 1));
         }
     }
 }
 
 WebServer::~WebServer() {
-    if (!isClose_) {
-        isClose_ = true;
-        close(listenFd_);
+    isClose_ = true;
+    // 先等线程池里的任务执行完并 join, 它们还会用到 Reactor 和数据库连接池
+    threadpool_.reset();
+    sqlpool_.reset();
+    for (auto& reactor : reactors_) {
+        if (reactor->listenFd >= 0) {
+            close(reactor->listenFd);
+        }
+        if (reactor->notifyFd >= 0) {
+            close(reactor->notifyFd);
+        }
     }
     SqlConnPool::Instance()->ClosePool();
 }
@@ -59,35 +136,77 @@ void WebServer::start() {
     if(!isClose_) {
         Log_Info("========== Server start =========="); 
     }
+    // 第 0 个 Reactor 在当前线程运行, 其余各占一个线程
+    std::vector<std::thread> loops;
+    for (size_t i = 1; i < reactors_.size() && !isClose_; i++) {
+        loops.emplace_back([this, reactor = reactors_[i].get()] {
+            eventLoop_(reactor);
+        });
+    }
+    if (!reactors_.empty()) {
+        eventLoop_(reactors_[0].get());
+    }
+    for (auto& loop : loops) {
+        loop.join();
+    }
+}
+
+void WebServer::eventLoop_(Reactor* reactor) {
+    assert(reactor);
+    reactor->loopThread = this_thread::get_id();
+    if (reactor->cpu >= 0 && !PinThread_(reactor->cpu)) {
+        Log_Warn("pin reactor to cpu %d error", reactor->cpu);
+    }
+    if (reactor->uring) {
+        uringLoop_(reactor);
+        return;
+    }
     int timeoutMs = -1;
     while (!isClose_) {
         if (timeoutMS_ > 0) {
-            timeoutMs = timer_->getNextTickMs();
+            timeoutMs = reactor->timer->getNextTickMs();
         }
-        int eventCnt = epoller_->wait(timeoutMs);
+        int eventCnt = reactor->epoller->wait(timeoutMs);
         Log_Info("epoll_wait get eventCnt: %d", eventCnt);
         for (int i = 0; i < eventCnt; i++) {
-            int eventFd = epoller_->getEventFd(i);
-            uint32_t events = epoller_->getEvents(i);
-            if (eventFd == listenFd_) {
-                dealListen_();
+            // 连接注册时存的是 ConnKey_, 监听套接字和 notifyFd 只存了 fd
+            uint64_t key = reactor->epoller->getEventData(i);
+            int fd = reactor->epoller->getEventFd(i);
+            if (fd == reactor->notifyFd) {
+                uint64_t count;
+                if (read(reactor->notifyFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    Log_Error("read notify fd error: %d", errno);
+                }
+                dealVerified_(reactor);
+                continue;
+            }
+            if (fd == reactor->listenFd) {
+                dealListen_(reactor);
+                continue;
+            }
+            HttpConn* client = FindConn_(reactor, key);
+            uint32_t events = reactor->epoller->getEvents(i);
+            if (client == nullptr) {
+                // 同一批事件里前面已经关闭了它(fd 可能又被新连接复用)
+                continue;
             } else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                assert(users_.count(eventFd) > 0);
-                closeConn_(&users_[eventFd]);
+                closeConn_(reactor, client);
             } else if (events & EPOLLIN) {
-                assert(users_.count(eventFd) > 0);
-                dealRead_(&users_[eventFd]);                    
+                dealRead_(reactor, client);
             } else if (events & EPOLLOUT) {
-                assert(users_.count(eventFd) > 0);
-                dealWrite_(&users_[eventFd]);
+                dealWrite_(reactor, client);
             } else {
                 Log_Error("Unexpected Event");
             }
         }
+        if (reactor->tasks) {
+            reactor->tasks->submit();
+        }
     }
 }
 
-bool WebServer::initSocket_() {
+bool WebServer::initSocket_(Reactor* reactor) {
+    assert(reactor);
     struct sockaddr_in addr;
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -97,14 +216,14 @@ bool WebServer::initSocket_() {
         optLinger.l_onoff = 1;
         optLinger.l_linger = 1;
     }
-    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (listenFd_ < 0) {
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0) {
         Log_Error("create socket error!");
         return false;
     }
-    int ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+    int ret = setsockopt(listenFd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
     if (ret < 0) {
-        close(listenFd_);
+        close(listenFd);
         Log_Error("Init linger error");
         return false;
     }
@@ -112,37 +231,194 @@ bool WebServer::initSocket_() {
     int optval = 1;
     /* 端口复用 */
     /* 只有最后一个套接字会正常接收数据。 */
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+    ret = setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
     if(ret == -1) {
         Log_Error("set socket setsockopt error !");
-        close(listenFd_);
+        close(listenFd);
         return false;
     }
+    if (reusePort_) {
+        /* 多 Reactor: 每个 Reactor 一个监听套接字, 由内核按四元组哈希分发连接 */
+        ret = setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, (const void*)&optval, sizeof(int));
+        if(ret == -1) {
+            Log_Error("set socket SO_REUSEPORT error !");
+            close(listenFd);
+            return false;
+        }
+    }
+
+    if (reusePort_ && incomingCpu_ && reactor->cpu >= 0) {
+        // 内核在同一组 SO_REUSEPORT 套接字里优先选 SO_INCOMING_CPU 和收包 CPU 相同的, 网卡队列、Reactor、连接内存在同一个核上
+        int cpu = reactor->cpu;
+        if (setsockopt(listenFd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0) {
+            Log_Warn("set socket SO_INCOMING_CPU error: %d", errno);
+        }
+    }
 
-    ret = bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr));
+    ret = bind(listenFd, (struct sockaddr*)&addr, sizeof(addr));
     if (ret < 0) {
         Log_Error("Bind Port:%d error!", port_);
-        close(listenFd_);
+        close(listenFd);
         return false;
     }
-    ret = listen(listenFd_, 6);
+    ret = listen(listenFd, 6);
     if (ret < 0) {
         Log_Error("Listen port:%d error!", port_);
-        close(listenFd_);
+        close(listenFd);
         return false;
     }
 
-    ret = epoller_->addFd(listenFd_, listenEvent_ | EPOLLIN);
+    if (reactor->uring) {
+        // io_uring 下 accept 由内核异步完成, 监听套接字保持阻塞
+        ret = reactor->uring->prepAccept(listenFd, static_cast<uint64_t>(listenFd) << 8 | URING_ACCEPT);
+    } else {
+        ret = reactor->epoller->addFd(listenFd, listenEvent_ | EPOLLIN, static_cast<uint64_t>(listenFd));
+    }
     if (!ret) {
         Log_Error("Add listen error!");
-        close(listenFd_);
+        close(listenFd);
         return false;
     }
-    SetFdNonblock(listenFd_);
-    Log_Info("Server listen at port:%d", port_);
+    if (!reactor->uring) {
+        SetFdNonblock(listenFd);
+    }
+    reactor->listenFd = listenFd;
+    Log_Info("Server listen at port:%d, listenFd: %d", port_, listenFd);
     return true;
 }
 
+std::vector<std::vector<int>> WebServer::CpuNodes_() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return {};
+    std::vector<std::pair<int, int>> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) continue;
+        // /sys/devices/system/cpu/cpuN/ 下有一个 nodeM 目录; 没有 NUMA 时都算节点 0
+        int node = 0;
+        std::string path = "/sys/devices/system/cpu/cpu" + to_string(cpu);
+        if (DIR* dir = opendir(path.c_str())) {
+            while (struct dirent* entry = readdir(dir)) {
+                if (strncmp(entry->d_name, "node", 4) == 0 && isdigit(entry->d_name[4])) {
+                    node = atoi(entry->d_name + 4);
+                    break;
+                }
+            }
+            closedir(dir);
+        }
+        cpus.emplace_back(node, cpu);
+    }
+    sort(cpus.begin(), cpus.end());
+    std::vector<std::vector<int>> nodes;
+    for (size_t i = 0; i < cpus.size(); i++) {
+        if (i == 0 || cpus[i].first != cpus[i - 1].first) nodes.emplace_back();
+        nodes.back().push_back(cpus[i].second);
+    }
+    return nodes;
+}
+
+void WebServer::PlanCpus_(int reactorNum, std::vector<int>* reactorCpus, std::vector<int>* workerCpus) {
+    std::vector<std::vector<int>> nodes = CpuNodes_();
+    if (nodes.empty()) return;
+    for (int i = 0; i < reactorNum; i++) {
+        const std::vector<int>& node = nodes[i % nodes.size()];
+        reactorCpus->push_back(node[(i / nodes.size()) % node.size()]);
+    }
+    for (auto& node : nodes) {
+        for (int cpu : node) {
+            if (cpu != (*reactorCpus)[0]) workerCpus->push_back(cpu);
+        }
+    }
+    if (workerCpus->empty()) {
+        // 只有一个 CPU
+        workerCpus->push_back((*reactorCpus)[0]);
+    }
+}
+
+bool WebServer::PinThread_(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool WebServer::initNotify_(Reactor* reactor) {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        Log_Error("create eventfd error!");
+        return false;
+    }
+    bool ret;
+    if (reactor->uring) {
+        ret = reactor->uring->prepRead(fd, &reactor->notifyBuf, sizeof(reactor->notifyBuf),
+                                       static_cast<uint64_t>(fd) << 8 | URING_NOTIFY);
+    } else {
+        ret = reactor->epoller->addFd(fd, EPOLLIN, static_cast<uint64_t>(fd));
+    }
+    if (!ret) {
+        Log_Error("Add notify fd error!");
+        close(fd);
+        return false;
+    }
+    reactor->notifyFd = fd;
+    return true;
+}
+
+void WebServer::submitVerify_(Reactor* reactor, HttpConn* client) {
+    if (sqlpool_->overloaded()) {
+        shedConn_(reactor, client);
+        return;
+    }
+    const HttpRequest& request = client->request();
+    auto job = std::make_unique<VerifyJob>();
+    job->reactor = reactor;
+    job->fd = client->getFd();
+    job->generation = client->getGeneration();
+    job->name = request.getPost("username");
+    job->pwd = request.getPost("password");
+    job->isLogin = request.isLogin();
+    sqlpool_->AddTask([job = std::move(job)]() mutable {
+        {
+            // 阻塞期间还有验证排队时, SQL 线程池直接补充线程
+            ThreadPool::BlockingScope blocking;
+            job->ok = HttpRequest::UserVerify(job->name, job->pwd, job->isLogin);
+        }
+        Reactor* reactor = job->reactor;
+        {
+            std::lock_guard<std::mutex> locker(reactor->verifyMtx);
+            reactor->verified.push_back(std::move(job));
+        }
+        uint64_t one = 1;
+        if (write(reactor->notifyFd, &one, sizeof(one)) < 0) {
+            Log_Error("write notify fd error: %d", errno);
+        }
+    });
+}
+
+void WebServer::dealVerified_(Reactor* reactor) {
+    std::vector<std::unique_ptr<VerifyJob>> jobs;
+    {
+        std::lock_guard<std::mutex> locker(reactor->verifyMtx);
+        jobs.swap(reactor->verified);
+    }
+    for (auto& job : jobs) {
+        HttpConn* client = reactor->users.get(job->fd, job->generation);
+        if (!client || !client->waitingVerify()) {
+            // 等待期间超时关闭了
+            continue;
+        }
+        client->verifyDone(job->ok);
+        extentTime_(reactor, client);
+        if (reactor->uring) {
+            uringProcess_(reactor, client);
+        } else if (reactor->tasks) {
+            addTask_(reactor, client, &WebServer::onProcess);
+        } else {
+            onProcess(reactor, client);
+        }
+    }
+}
+
 void WebServer::initEventMode_(int trigMode) {
     listenEvent_ = EPOLLRDHUP;
     connEvent_ = EPOLLONESHOT | EPOLLRDHUP;
@@ -168,26 +444,40 @@ void WebServer::initEventMode_(int trigMode) {
     HttpConn::isET = (connEvent_ & EPOLLET); 
 }
 
-void WebServer::addClient_(int fd, sockaddr_in addr) {
+void WebServer::addClient_(Reactor* reactor, int fd, sockaddr_in addr) {
     assert(fd > 0);
-    users_[fd].init(fd, addr);
-    if (timeoutMS_ > 0) {
-        timer_->add(fd, timeoutMS_, [this, fd] {
-            closeConn_(&this->users_[fd]);
-        });
-    }
-    epoller_->addFd(fd, connEvent_ | EPOLLIN);
+    HttpConn* client = reactor->users.acquire(fd, addr);
+    addTimer_(reactor, client);
+    reactor->epoller->addFd(fd, connEvent_ | EPOLLIN, ConnKey_(client));
     SetFdNonblock(fd);
     Log_Info("Client[%d] in!", fd);
 }
 
-void WebServer::dealListen_() {
+void WebServer::addTimer_(Reactor* reactor, HttpConn* client) {
+    if (timeoutMS_ <= 0) return;
+    // 计时器节点嵌在连接里, fd 被复用时槽位和节点一起复用, 不会误关新连接
+    TimerHook* hook = client->timer();
+    hook->cb = OnTimeout_;
+    hook->ctx = reactor;
+    // 连接关闭后计时器可能还挂着, 到期时按 key 找回, 连接已关闭或 fd 已被复用就不处理
+    hook->arg = reinterpret_cast<void*>(static_cast<uintptr_t>(ConnKey_(client)));
+    reactor->timer->add(hook, timeoutMS_);
+}
+
+void WebServer::OnTimeout_(void* ctx, void* arg) {
+    Reactor* reactor = static_cast<Reactor*>(ctx);
+    HttpConn* client = FindConn_(reactor, reinterpret_cast<uintptr_t>(arg));
+    if (!client) return;
+    reactor->server->closeConn_(reactor, client);
+}
+
+void WebServer::dealListen_(Reactor* reactor) {
     struct sockaddr_in addr;
     socklen_t len = sizeof(addr);
     do {
-        int fd = accept(listenFd_, (sockaddr*)&addr, &len);
+        int fd = accept(reactor->listenFd, (sockaddr*)&addr, &len);
         if (fd < 0) return;
-        else if(HttpConn::userCount >= MAX_FD) {
+        else if(fd >= MAX_FD || HttpConn::userCount >= MAX_FD) {
             string info("Server busy!");
             int ret = send(fd, info.data(), info.length(), 0);
             if (ret < 0) {
@@ -197,77 +487,320 @@ void WebServer::dealListen_() {
             Log_Warn("Client is full");
             return;
         }
-        addClient_(fd, addr);
+        addClient_(reactor, fd, addr);
     } while (listenEvent_ & EPOLLET);
 }
 
-void WebServer::dealWrite_(HttpConn* client) {
+void WebServer::dealWrite_(Reactor* reactor, HttpConn* client) {
     assert(client);
-    extentTime_(client);
-    threadpool_->AddTask([this, client] {
-        onWrite_(client);
-    });
+    extentTime_(reactor, client);
+    if (!reactor->tasks) {
+        // 多 Reactor 模式下直接在本线程写
+        onWrite_(reactor, client);
+        return;
+    }
+    addTask_(reactor, client, &WebServer::onWrite_);
 }
 
-void WebServer::dealRead_(HttpConn* client) {
+void WebServer::dealRead_(Reactor* reactor, HttpConn* client) {
     assert(client);
-    extentTime_(client);
-    threadpool_->AddTask([this, client] {
-        onRead_(client);
-    });
+    extentTime_(reactor, client);
+    if (!reactor->tasks) {
+        // 多 Reactor 模式下直接在本线程读
+        onRead_(reactor, client);
+        return;
+    }
+    if (client->idle() && threadpool_->overloaded()) {
+        // 排进去也要等很久, 客户端多半已经超时, 不如现在就拒绝; 只拒绝新请求, 处理到一半的请求继续
+        shedConn_(reactor, client);
+        return;
+    }
+    addTask_(reactor, client, &WebServer::onRead_);
+}
+
+void WebServer::addTask_(Reactor* reactor, HttpConn* client, ConnHandler handler) {
+    uint64_t key = ConnKey_(client);
+    auto task = [this, reactor, key, handler] {
+        // 排队期间连接可能被超时关闭, fd 又被新连接复用
+        HttpConn* client = FindConn_(reactor, key);
+        if (!client) return;
+        (this->*handler)(reactor, client);
+    };
+    if (connAffinity_) {
+        reactor->tasks->add(client->getFd(), std::move(task));
+    } else {
+        reactor->tasks->add(std::move(task));
+    }
 }
 
-void WebServer::extentTime_(HttpConn* client) {
+void WebServer::extentTime_(Reactor* reactor, HttpConn* client) {
     assert(client);
-    if (timeoutMS_ > 0) timer_->adjust(client->getFd(), timeoutMS_);
+    // 用 add 而不是 adjust: 节点已经到期摘下时也能重新挂上
+    if (timeoutMS_ > 0) reactor->timer->add(client->timer(), timeoutMS_);
 }
 
-void WebServer::closeConn_(HttpConn* client) {
+void WebServer::closeConn_(Reactor* reactor, HttpConn* client) {
     assert(client);
+    if (reactor->uring) {
+        uringClose_(reactor, client);
+        return;
+    }
     Log_Info("Client[%d] quit!", client->getFd());
-    epoller_->delFd(client->getFd());
+    if (!threadpool_ || this_thread::get_id() == reactor->loopThread) {
+        // 在工作线程里关闭时不能碰计时器, 只在 Reactor 线程操作, 留给它到期, 到期时按 generation 丢弃
+        reactor->timer->cancel(client->timer());
+    }
+    reactor->epoller->delFd(client->getFd());
     client->close();
 }
 
-void WebServer::onRead_(HttpConn* client) {
+void WebServer::shedConn_(Reactor* reactor, HttpConn* client) {
+    assert(client);
+    int fd = client->getFd();
+    // 接收缓冲区里还有数据时 close 会发 RST, 对端可能收不到回复, 先读掉
+    char buf[4096];
+    for (int i = 0; i < SHED_DRAIN_ROUNDS && recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0; i++) {}
+    if (send(fd, SHED_RESPONSE, sizeof(SHED_RESPONSE) - 1, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        Log_Warn("send 503 to client[%d] error", fd);
+    }
+    Log_Info("Client[%d] shed, server overloaded", fd);
+    closeConn_(reactor, client);
+}
+
+void WebServer::onRead_(Reactor* reactor, HttpConn* client) {
     assert(client);
     int readErrno = 0;
     ssize_t ret = client->read(&readErrno);
     if (ret < 0 && readErrno != EAGAIN) {
-        closeConn_(client);
+        closeConn_(reactor, client);
         Log_Error("client[%d] error when read", client->getFd());
         return;
     }
-    onProcess(client);
+    onProcess(reactor, client);
 }
 
-void WebServer::onWrite_(HttpConn* client) {
+void WebServer::onWrite_(Reactor* reactor, HttpConn* client) {
     assert(client);
     int writeErrno = 0;
     int ret = client->write(&writeErrno);
     if (client->toWriteBytes() == 0) {
         // 写完了
         if(client->isKeepAlive()) {
-            onProcess(client);
+            onProcess(reactor, client);
             return;
         }
     } else if (ret < 0) {
         if (writeErrno == EAGAIN) {
             // 缓冲区写满了, 要重新写
-            epoller_->modFd(client->getFd(), connEvent_ | EPOLLOUT);
+            reactor->epoller->modFd(client->getFd(), connEvent_ | EPOLLOUT, ConnKey_(client));
             return;
         }
     }
-    closeConn_(client);
+    closeConn_(reactor, client);
 }
 
-void WebServer::onProcess(HttpConn* client) {
+void WebServer::onProcess(Reactor* reactor, HttpConn* client) {
     assert(client);
     if (client->process()) {
-        epoller_->modFd(client->getFd(), connEvent_ | EPOLLOUT);
+        reactor->epoller->modFd(client->getFd(), connEvent_ | EPOLLOUT, ConnKey_(client));
+    } else if (client->waitingVerify()) {
+        // EPOLLONESHOT 已经触发过, 不重新注册, 验证完成前连接上的事件都不处理
+        submitVerify_(reactor, client);
     } else {
         // 没有读入完成, 需要继续读入
-        epoller_->modFd(client->getFd(), connEvent_ | EPOLLIN);
+        reactor->epoller->modFd(client->getFd(), connEvent_ | EPOLLIN, ConnKey_(client));
+    }
+}
+
+void WebServer::uringLoop_(Reactor* reactor) {
+    assert(reactor && reactor->uring);
+    int timeoutMs = -1;
+    while (!isClose_) {
+        if (timeoutMS_ > 0) {
+            timeoutMs = reactor->timer->getNextTickMs();
+        }
+        // 上一轮准备好的所有 SQE 在这里一次提交
+        int eventCnt = reactor->uring->wait(timeoutMs);
+        if (eventCnt < 0) {
+            Log_Error("io_uring wait error: %d", errno);
+            continue;
+        }
+        for (int i = 0; i < eventCnt; i++) {
+            uint64_t userData = reactor->uring->getUserData(i);
+            int fd = static_cast<int>(userData >> 8);
+            int res = reactor->uring->getResult(i);
+            switch (userData & 0xff) {
+            case URING_ACCEPT:
+                uringAccept_(reactor, res, reactor->uring->getFlags(i) & IORING_CQE_F_MORE);
+                break;
+            case URING_RECV:
+                uringRecv_(reactor, fd, res, i);
+                break;
+            case URING_WRITEV:
+                uringWritev_(reactor, fd, res);
+                break;
+            case URING_CLOSE:
+                if (res < 0) Log_Warn("io_uring close fd[%d] error: %d", fd, -res);
+                break;
+            case URING_NOTIFY:
+                dealVerified_(reactor);
+                if (!reactor->uring->prepRead(fd, &reactor->notifyBuf, sizeof(reactor->notifyBuf), userData)) {
+                    Log_Error("io_uring submit notify read error");
+                }
+                break;
+            default:
+                Log_Error("Unexpected io_uring event");
+            }
+        }
+    }
+}
+
+void WebServer::uringAccept_(Reactor* reactor, int fd, bool more) {
+    if (!more) {
+        // 多路 accept 被内核终止, 重新挂上
+        reactor->uring->prepAccept(reactor->listenFd, static_cast<uint64_t>(reactor->listenFd) << 8 | URING_ACCEPT);
+    }
+    if (fd < 0) {
+        Log_Warn("io_uring accept error: %d", -fd);
+        return;
+    }
+    if (fd >= MAX_FD || HttpConn::userCount >= MAX_FD) {
+        string info("Server busy!");
+        send(fd, info.data(), info.length(), MSG_DONTWAIT);
+        close(fd);
+        Log_Warn("Client is full");
+        return;
+    }
+    struct sockaddr_in addr = {0};
+    socklen_t len = sizeof(addr);
+    getpeername(fd, (sockaddr*)&addr, &len);
+    HttpConn* client = reactor->users.acquire(fd, addr);
+    reactor->uringState[fd] = 0;
+    addTimer_(reactor, client);
+    uringSubmit_(reactor, client, URING_RECV);
+}
+
+void WebServer::uringRecv_(Reactor* reactor, int fd, int res, size_t i) {
+    HttpConn* client = reactor->users.get(fd);
+    assert(client);
+    uint8_t& state = reactor->uringState[fd];
+    bool more = reactor->uring->getFlags(i) & IORING_CQE_F_MORE;
+    if (!more) state &= ~URING_RECVING;
+    const char* buf = reactor->uring->getBuffer(i);
+    if (buf) {
+        // 多路 recv: 复制进读缓冲区, 缓冲区马上还给内核
+        if (res > 0 && !(state & URING_CLOSING)) client->appendRecv(buf, res);
+        reactor->uring->recycleBuffer(i);
+    } else if (res > 0 && !(state & URING_CLOSING)) {
+        // 单次 recv 直接收进了读缓冲区
+        client->hasRecv(res);
+    }
+    if (state & URING_CLOSING) {
+        uringClose_(reactor, client);
+        return;
+    }
+    if (res == -ENOBUFS && !more) {
+        // 缓冲区组一时用完, 内核结束了多路 recv, 重新挂上
+        uringSubmit_(reactor, client, URING_RECV);
+        return;
+    }
+    if (res == -EINVAL && !more && reactor->multishotRecv) {
+        Log_Warn("io_uring multishot recv unsupported, use single-shot recv");
+        reactor->multishotRecv = false;
+        uringSubmit_(reactor, client, URING_RECV);
+        return;
+    }
+    if (res <= 0) {
+        // 对端关闭或者出错
+        uringClose_(reactor, client);
+        return;
+    }
+    extentTime_(reactor, client);
+    if (state & URING_WRITING || client->waitingVerify()) {
+        // 多路 recv 一直挂着, 前一批响应还在写或者在等数据库时先攒着, 之后由 uringWritev_/dealVerified_ 处理
+        if (client->readBytes() > URING_RECV_BACKLOG) {
+            Log_Warn("client[%d] sends too much without reading", fd);
+            uringClose_(reactor, client);
+        }
+        return;
+    }
+    uringProcess_(reactor, client);
+}
+
+void WebServer::uringProcess_(Reactor* reactor, HttpConn* client) {
+    if (client->process()) {
+        uringSubmit_(reactor, client, URING_WRITEV);
+    } else if (client->waitingVerify()) {
+        submitVerify_(reactor, client);
+    } else {
+        uringSubmit_(reactor, client, URING_RECV);
+    }
+}
+
+void WebServer::uringWritev_(Reactor* reactor, int fd, int res) {
+    HttpConn* client = reactor->users.get(fd);
+    assert(client);
+    reactor->uringState[fd] &= ~URING_WRITING;
+    if (reactor->uringState[fd] & URING_CLOSING || res < 0) {
+        uringClose_(reactor, client);
+        return;
+    }
+    client->hasSent(res);
+    extentTime_(reactor, client);
+    if (client->toWriteBytes() > 0) {
+        uringSubmit_(reactor, client, URING_WRITEV);
+    } else if (client->isKeepAlive()) {
+        // 与 onWrite_ 一致, 写完后处理缓冲区里剩下的请求
+        uringProcess_(reactor, client);
+    } else {
+        uringClose_(reactor, client);
+    }
+}
+
+void WebServer::uringSubmit_(Reactor* reactor, HttpConn* client, URING_OP op) {
+    int fd = client->getFd();
+    uint64_t userData = static_cast<uint64_t>(fd) << 8 | op;
+    bool ret = false;
+    uint8_t flag = op == URING_RECV ? URING_RECVING : URING_WRITING;
+    // 多路 recv 还挂着, 不用再提交
+    if (reactor->uringState[fd] & flag) return;
+    if (op == URING_RECV && reactor->multishotRecv) {
+        ret = reactor->uring->prepRecvMultishot(fd, userData);
+    } else if (op == URING_RECV) {
+        size_t len = 0;
+        char* buf = client->beginRecv(&len);
+        ret = reactor->uring->prepRecv(fd, buf, len, userData);
+    } else {
+        int iovCnt = 0;
+        const iovec* iov = client->writeIov(&iovCnt);
+        ret = reactor->uring->prepWritev(fd, iov, iovCnt, userData);
+    }
+    if (!ret) {
+        Log_Error("io_uring submit error, client[%d]", fd);
+        uringClose_(reactor, client);
+        return;
+    }
+    reactor->uringState[fd] |= flag;
+}
+
+void WebServer::uringClose_(Reactor* reactor, HttpConn* client) {
+    int fd = client->getFd();
+    if (fd < 0) return;
+    if (reactor->uringState[fd] & URING_INFLIGHT) {
+        // 还有请求在内核里, 先 shutdown 让它完成, 在它的 CQE 里再关闭
+        if (!(reactor->uringState[fd] & URING_CLOSING)) {
+            reactor->uringState[fd] |= URING_CLOSING;
+            shutdown(fd, SHUT_RDWR);
+        }
+        return;
+    }
+    reactor->uringState[fd] = 0;
+    reactor->timer->cancel(client->timer());
+    fd = client->detach();
+    if (fd < 0) return;
+    Log_Info("Client[%d] quit!", fd);
+    if (!reactor->uring->prepClose(fd, static_cast<uint64_t>(fd) << 8 | URING_CLOSE)) {
+        close(fd);
     }
 }
 
@@ -275,4 +808,4 @@ void WebServer::onProcess(HttpConn* client) {
 int WebServer::SetFdNonblock(int fd) {
     assert(fd > 0);
     return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
-}
\ No newline at end of file
+}
@@ -1,7 +1,9 @@
 #ifndef _WEBSERVER_H_
 #define _WEBSERVER_H_
 
-#include <unordered_map>
+#include <vector>
+#include <thread>
+#include <mutex>
 #include <fcntl.h>       // fcntl()
 #include <unistd.h>      // close()
 #include <assert.h>
@@ -11,60 +13,188 @@
 #include <arpa/inet.h>
 
 #include "epoller.h"
+#include "uring.h"
+#include "conntable.h"
 #include "../log/log.h"
-#include "../timer/heaptimer.h"
+#include "../timer/timewheel.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
 #include "../pool/sqlconnRAII.h"
 #include "../http/httpconn.h"
+#include "../http/filecache.h"
 
 
 
 class WebServer {
 public:
+    // reactorNum == 0: 单 Reactor, 主线程 epoll_wait, 读写任务交给线程池
+    // reactorNum > 0 : 多 Reactor, 每个线程一个 Epoller/TimeWheel/连接表,
+    //                  各自持有一个 SO_REUSEPORT 监听套接字, 读写在本线程完成
+    // useUring: 每个 Reactor 用 io_uring 代替 epoll, 读写均在本线程提交
+    // pinCpu: Reactor 和线程池的线程绑定 CPU, Reactor 轮流分到各个 NUMA 节点, 线程池优先用 Reactor 所在节点
+    // incomingCpu: 多 Reactor 时给每个监听套接字设置 SO_INCOMING_CPU, 连接优先交给在收包 CPU 上的 Reactor
+    // connAffinity: 单 Reactor 模式下同一个连接的读写任务都交给同一个工作线程, 只在它忙不过来时被别的线程窃取
     WebServer(
-        int port, int trigMode, int timeoutMS, bool optLinger, 
-        int sqlPort, const std::string& sqlUser, const std::string& sqlPwd, 
+        int port, int trigMode, int timeoutMS, bool optLinger,
+        int sqlPort, const std::string& sqlUser, const std::string& sqlPwd,
         const std::string& dbName, int connPoolNum, int threadNum,
-        bool openLog, Log::LogLevel logLevel, int logQueSize);
+        bool openLog, Log::LogLevel logLevel, int logQueSize,
+        int reactorNum = 0, bool useUring = false,
+        bool pinCpu = false, bool incomingCpu = false, bool connAffinity = false);
 
     ~WebServer();
     void start();
 
 private:
-    bool initSocket_(); 
+    static const int MAX_FD = 65536;
+
+    struct Reactor;
+
+    // 交给 SQL 线程池的用户验证, 只带用户名密码, 不引用连接本身;
+    // 完成后回到连接所属的 Reactor, 按 fd 和 generation 找回连接, 期间连接关闭或被复用时丢弃
+    struct VerifyJob {
+        Reactor* reactor;
+        int fd;
+        uint32_t generation;
+        std::string name;
+        std::string pwd;
+        bool isLogin;
+        bool ok = false;
+    };
+
+    // 一个事件循环所拥有的全部状态, 除了 verified 都只在所属线程内访问
+    struct Reactor {
+        WebServer* server = nullptr;
+        int listenFd = -1;
+        std::unique_ptr<Epoller> epoller;
+        // 连接里嵌着计时器节点, users 要比 timer 后析构
+        ConnTable users{MAX_FD};
+        std::unique_ptr<TimeWheel> timer;
+        // 绑定的 CPU, -1 表示不绑定
+        int cpu = -1;
+        // 运行事件循环的线程
+        std::thread::id loopThread;
+        // 单 Reactor 模式下, 一轮事件产生的任务攒在这里, 处理完这一轮再一起提交给线程池
+        std::unique_ptr<ThreadPool::Batch> tasks;
+        // io_uring 后端, 为空时使用 epoller
+        std::unique_ptr<Uring> uring;
+        // fd -> URING_STATE 的组合
+        std::vector<uint8_t> uringState;
+        // 使用多路 recv 和缓冲区组; 内核不支持时退回每次一个 recv, 直接收进连接的读缓冲区
+        bool multishotRecv = false;
+        // SQL 线程池写这个 eventfd 唤醒 Reactor, 取走 verified 里完成的验证
+        int notifyFd = -1;
+        // io_uring 读 notifyFd 的缓冲区
+        uint64_t notifyBuf = 0;
+        std::mutex verifyMtx;
+        std::vector<std::unique_ptr<VerifyJob>> verified;
+    };
+
+    // io_uring user_data 的低 8 位
+    enum URING_OP {
+        URING_ACCEPT = 0,
+        URING_RECV,
+        URING_WRITEV,
+        URING_CLOSE,
+        URING_NOTIFY,
+    };
+
+    enum URING_STATE {
+        // 挂着 recv (多路 recv 收到不带 IORING_CQE_F_MORE 的 CQE 之前一直挂着)
+        URING_RECVING = 1,
+        URING_CLOSING = 2,
+        URING_WRITING = 4,
+        URING_INFLIGHT = URING_RECVING | URING_WRITING,
+    };
+
+    // 每个 Reactor 的接收缓冲区组: 多路 recv 收到的数据先放在这里, 复制进连接的读缓冲区后立即还回去
+    static const unsigned URING_BUF_ENTRIES = 512;
+    static const unsigned URING_BUF_SIZE = 4096;
+    // 写响应或等数据库期间, 读缓冲区里最多攒这么多没处理的数据, 超过就关闭连接
+    static const size_t URING_RECV_BACKLOG = 1 << 20;
+
+    bool initSocket_(Reactor* reactor);
     void initEventMode_(int trigMode);
-    void addClient_(int fd, sockaddr_in addr);
-  
-    void dealListen_();
-    void dealWrite_(HttpConn* client);
-    void dealRead_(HttpConn* client);
+    void addClient_(Reactor* reactor, int fd, sockaddr_in addr);
+    void addTimer_(Reactor* reactor, HttpConn* client);
+    static void OnTimeout_(void* ctx, void* arg);
 
-    void extentTime_(HttpConn* client);
-    void closeConn_(HttpConn* client);
+    void eventLoop_(Reactor* reactor);
+    void uringLoop_(Reactor* reactor);
 
-    void onRead_(HttpConn* client);
-    void onWrite_(HttpConn* client);
-    void onProcess(HttpConn* client);
+    void uringAccept_(Reactor* reactor, int fd, bool more);
+    // i 是 CQE 在这一批里的下标, 用来取多路 recv 的缓冲区
+    void uringRecv_(Reactor* reactor, int fd, int res, size_t i);
+    void uringWritev_(Reactor* reactor, int fd, int res);
+    void uringSubmit_(Reactor* reactor, HttpConn* client, URING_OP op);
+    void uringClose_(Reactor* reactor, HttpConn* client);
+    // process 之后按结果提交写、读, 或者交给 SQL 线程池
+    void uringProcess_(Reactor* reactor, HttpConn* client);
 
-    static const int MAX_FD = 65536;
+    bool initNotify_(Reactor* reactor);
+    // 把连接停在的登录/注册请求交给 SQL 线程池, 连接在结果回来之前不监听任何事件
+    void submitVerify_(Reactor* reactor, HttpConn* client);
+    // Reactor 线程: 填入完成的验证结果, 继续处理这些连接
+    void dealVerified_(Reactor* reactor);
+
+    void dealListen_(Reactor* reactor);
+    void dealWrite_(Reactor* reactor, HttpConn* client);
+    void dealRead_(Reactor* reactor, HttpConn* client);
+
+    using ConnHandler = void (WebServer::*)(Reactor*, HttpConn*);
+
+    // 交给线程池执行 handler, 按 connAffinity_ 决定是否固定到连接的工作线程
+    // 任务只带连接的 key, 执行时连接已经关闭或被新连接复用就丢弃
+    void addTask_(Reactor* reactor, HttpConn* client, ConnHandler handler);
+
+    // 高 32 位 generation, 低 32 位 fd; 用在 epoll 事件、计时器和线程池任务里
+    static uint64_t ConnKey_(const HttpConn* client) {
+        return static_cast<uint64_t>(client->getGeneration()) << 32 | static_cast<uint32_t>(client->getFd());
+    }
+
+    // key 对应的连接, 连接已关闭或 fd 已经被新连接复用时返回 nullptr
+    static HttpConn* FindConn_(Reactor* reactor, uint64_t key) {
+        return reactor->users.get(static_cast<int>(key & 0xffffffff), static_cast<uint32_t>(key >> 32));
+    }
+
+    void extentTime_(Reactor* reactor, HttpConn* client);
+    void closeConn_(Reactor* reactor, HttpConn* client);
+    // 线程池过载时不解析请求, 直接回复 SHED_RESPONSE 并关闭连接
+    void shedConn_(Reactor* reactor, HttpConn* client);
+
+    void onRead_(Reactor* reactor, HttpConn* client);
+    void onWrite_(Reactor* reactor, HttpConn* client);
+    void onProcess(Reactor* reactor, HttpConn* client);
 
     static int SetFdNonblock(int fd);
 
+    static const char SHED_RESPONSE[];
+    // 拒绝时最多读掉这么多次已经到达的数据
+    static const int SHED_DRAIN_ROUNDS = 4;
+
+    // 当前线程允许使用的 CPU, 按 NUMA 节点分组
+    static std::vector<std::vector<int>> CpuNodes_();
+    // 第 i 个 Reactor 放在第 i % 节点数 个节点上; 线程池用除第 0 个 Reactor 之外的 CPU, 从它所在的节点开始
+    static void PlanCpus_(int reactorNum, std::vector<int>* reactorCpus, std::vector<int>* workerCpus);
+    static bool PinThread_(int cpu);
+
     int port_;
     bool openLinger_;
     int timeoutMS_;  /* 毫秒MS */
     bool isClose_;
-    int listenFd_;
+    bool reusePort_;
+    bool incomingCpu_;
+    bool connAffinity_;
     std::string srcDir_;
-    
+
     uint32_t listenEvent_;
     uint32_t connEvent_;
-   
-    std::unique_ptr<HeapTimer> timer_;
+
+    // 单 Reactor 模式下才会创建线程池
     std::unique_ptr<ThreadPool> threadpool_;
-    std::unique_ptr<Epoller> epoller_;
-    std::unordered_map<int, HttpConn> users_;
+    // 只执行会阻塞在数据库上的任务, 最多和数据库连接数一样多; 数据库慢时不会占满 threadpool_ 或 Reactor
+    std::unique_ptr<ThreadPool> sqlpool_;
+    std::vector<std::unique_ptr<Reactor>> reactors_;
 };
 
 #endif
@@ -1,5 +1,6 @@
 #include "heaptimer.h"
 #include <assert.h>
+#include <algorithm>
 
 using namespace std;
 
@@ -20,8 +21,8 @@ void HeapTimer::swapNode_(size_t i, size_t j) {
     assert(j >= 0 && j < size());
     if (i == j) return;
     std::swap(heap_[i], heap_[j]);
-    ref_[heap_[i].id] = i;
-    ref_[heap_[j].id] = j;
+    ids_[heap_[i].id].index = i;
+    ids_[heap_[j].id].index = j;
 }
 
 bool HeapTimer::shiftdown_(size_t index) {
@@ -40,26 +41,28 @@ bool HeapTimer::shiftdown_(size_t index) {
 }
 
 void HeapTimer::adjust(int id, int timeoutMs) {
-    assert(ref_.count(id) > 0);
-    size_t index = ref_[id];
+    assert(has_(id));
+    size_t index = ids_[id].index;
     heap_[index].expires = Clock::now() + MS(timeoutMs);
     if (!shiftdown_(index)) {
         shiftup_(index);
     }
 }
 
-void HeapTimer::add(int id, int timeoutMs, const TimeoutCallBack& cb) {
+void HeapTimer::add(int id, int timeoutMs, TimeoutCallBack cb) {
     assert (id >= 0);
-    if (ref_.count(id) == 0) {
+    if (static_cast<size_t>(id) >= ids_.size()) {
+        ids_.resize(max(static_cast<size_t>(id) + 1, ids_.size() * 2));
+    }
+    ids_[id].cb = std::move(cb);
+    if (ids_[id].index == NPOS) {
         // 新节点
         size_t index = size();
-        ref_[id] = index;
-        heap_.push_back({id, Clock::now() + MS(timeoutMs), cb});
+        ids_[id].index = index;
+        heap_.push_back({id, Clock::now() + MS(timeoutMs)});
         shiftup_(index);
     } else {
         // 已有节点, 重新调整
-        size_t index = ref_[id];
-        heap_[index].cb = cb;
         adjust(id, timeoutMs);
     }
 }
@@ -69,7 +72,8 @@ void HeapTimer::del_(size_t index) {
     assert (index >= 0 && index < size());
     swapNode_(index, heap_.size() - 1);
     int id = heap_.back().id;
-    ref_.erase(id);
+    ids_[id].index = NPOS;
+    ids_[id].cb = nullptr;
     heap_.pop_back();
     if (index < heap_.size()) {
         shiftdown_(index);
@@ -78,12 +82,13 @@ void HeapTimer::del_(size_t index) {
 
 void HeapTimer::doWork(int id) {
     assert(id >= 0);
-    if (ref_.count(id) == 0) {
+    if (!has_(id)) {
         return;
     }
-    size_t index = ref_[id];
-    heap_[index].cb();
+    size_t index = ids_[id].index;
+    TimeoutCallBack cb = std::move(ids_[id].cb);
     del_(index);
+    cb();
 }
 
 void HeapTimer::pop() {
@@ -92,8 +97,12 @@ void HeapTimer::pop() {
 }
 
 void HeapTimer::clear() {
+    // 只重置堆里的 id, 槽位保留
+    for (const TimerNode& node : heap_) {
+        ids_[node.id].index = NPOS;
+        ids_[node.id].cb = nullptr;
+    }
     heap_.clear();
-    ref_.clear();
 }
 
 void HeapTimer::tick() {
@@ -104,8 +113,9 @@ void HeapTimer::tick() {
         if (chrono::duration_cast<MS>(node.expires - Clock::now()).count() > 0) {
             break;
         }
-        node.cb();
+        TimeoutCallBack cb = std::move(ids_[node.id].cb);
         pop();
+        cb();
     }
 }
 
@@ -2,20 +2,22 @@
 #define _HEAPTIMER_H_
 
 #include <chrono>
-#include <functional>
 #include <vector>
+#include <stddef.h>
 
-using TimeoutCallBack = std::function<void()>;
+#include "../pool/task.h"
+
+// 只能移动, 捕获内容放在对象内部, 添加计时器不分配内存
+using TimeoutCallBack = Task;
 using Clock = std::chrono::high_resolution_clock;
 using MS = std::chrono::milliseconds;
 using TimeStamp = Clock::time_point;
 
+// 堆节点只有 id 和超时时间, 回调单独存放, 交换节点时不用搬动回调
 struct TimerNode {
     int id;
     // 超时时间
     TimeStamp expires;
-    // 超时回调函数
-    TimeoutCallBack cb;
     bool operator< (const TimerNode& rhs) {
         return expires < rhs.expires;
     }
@@ -43,7 +45,11 @@ struct TimerNode {
 
 class HeapTimer {
 public:
-    HeapTimer() { heap_.reserve(64); }
+    // id 从 0 开始(比如 fd), 按 id 下标存放, 预留 capacity 个; 更大的 id 出现时成倍扩充, 之后一直复用
+    explicit HeapTimer(size_t capacity = 64) {
+        heap_.reserve(capacity);
+        ids_.resize(capacity);
+    }
     
     ~HeapTimer() { 
         clear();
@@ -53,7 +59,7 @@ public:
     void adjust(int id, int newTimeOutMs);
 
     // 添加一个新的计时器
-    void add(int id, int timeoutMs, const TimeoutCallBack& cb);
+    void add(int id, int timeoutMs, TimeoutCallBack cb);
 
     // 调用回调函数并删除节点
     void doWork(int id);
@@ -83,9 +89,22 @@ private:
 
     void swapNode_(size_t i, size_t j);
 
+    // 不在堆里的 id 的位置
+    static const size_t NPOS = static_cast<size_t>(-1);
+
+    // 每个 id 一个, 添加和删除计时器只改里面的字段, 不分配内存
+    struct IdSlot {
+        // 在 heap_ 中的下标
+        size_t index = NPOS;
+        TimeoutCallBack cb;
+    };
+
+    bool has_(int id) const {
+        return id >= 0 && static_cast<size_t>(id) < ids_.size() && ids_[id].index != NPOS;
+    }
+
     std::vector<TimerNode> heap_;
-    // id -> heap position
-    std::unordered_map<int, size_t> ref_;
+    std::vector<IdSlot> ids_;
 };
 
 
@@ -0,0 +1,25 @@
+#ifndef _TIMERHOOK_H_
+#define _TIMERHOOK_H_
+
+#include <stdint.h>
+
+// 侵入式计时器节点, 直接嵌在宿主对象 (比如 HttpConn) 里, 由 TimeWheel 串进槽链表
+// 到期动作是普通函数指针加上下文, 不需要 std::function, 也就没有堆分配
+struct TimerHook {
+    using Callback = void (*)(void* ctx, void* arg);
+
+    Callback cb = nullptr;
+    void* ctx = nullptr;
+    void* arg = nullptr;
+
+    // 以下字段由 TimeWheel 维护
+    uint64_t expires = 0;
+    TimerHook* prev = nullptr;
+    TimerHook* next = nullptr;
+    // 所在的槽, -1 表示不在时间轮里
+    int slot = -1;
+
+    bool linked() const { return slot >= 0; }
+};
+
+#endif
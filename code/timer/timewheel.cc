@@ -0,0 +1,223 @@
+#include "timewheel.h"
+#include <assert.h>
+#include <limits.h>
+
+using namespace std;
+
+// 位图循环右移, 让 from 号槽落在第 0 位
+static inline uint64_t RotateRight(uint64_t bits, int from) {
+    return from == 0 ? bits : (bits >> from) | (bits << (64 - from));
+}
+
+TimeWheel::TimeWheel(): start_(Clock::now()), current_(0), size_(0) {
+    fill(begin(heads_), end(heads_), nullptr);
+    fill(begin(occupied_), end(occupied_), 0);
+}
+
+uint64_t TimeWheel::nowMs_() const {
+    return chrono::duration_cast<MS>(Clock::now() - start_).count();
+}
+
+void TimeWheel::link_(TimerHook* hook, int slot) {
+    hook->slot = slot;
+    hook->prev = nullptr;
+    hook->next = heads_[slot];
+    if (heads_[slot]) {
+        heads_[slot]->prev = hook;
+    }
+    heads_[slot] = hook;
+    if (slot < EXPIRED) {
+        occupied_[slot >> SLOT_BITS] |= 1ULL << (slot & SLOT_MASK);
+    }
+}
+
+void TimeWheel::unlink_(TimerHook* hook) {
+    assert(hook->linked());
+    if (hook->prev) {
+        hook->prev->next = hook->next;
+    } else {
+        heads_[hook->slot] = hook->next;
+    }
+    if (hook->next) {
+        hook->next->prev = hook->prev;
+    }
+    if (!heads_[hook->slot] && hook->slot < EXPIRED) {
+        occupied_[hook->slot >> SLOT_BITS] &= ~(1ULL << (hook->slot & SLOT_MASK));
+    }
+    hook->slot = -1;
+    hook->prev = hook->next = nullptr;
+}
+
+void TimeWheel::insert_(TimerHook* hook) {
+    // 已经到期的放到下一毫秒, 否则要等一整圈
+    uint64_t expires = max(hook->expires, current_ + 1);
+    uint64_t delta = expires - current_;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    if (delta >= (1ULL << (SLOT_BITS * LEVELS))) {
+        // 超出最大范围, 先挂在最高层, 级联时会重新计算
+        expires = current_ + (1ULL << (SLOT_BITS * LEVELS)) - 1;
+    }
+    int index = (expires >> (SLOT_BITS * level)) & SLOT_MASK;
+    link_(hook, level * SLOTS + index);
+}
+
+void TimeWheel::cascade_(int level, int index) {
+    int slot = level * SLOTS + index;
+    while (heads_[slot]) {
+        TimerHook* hook = heads_[slot];
+        unlink_(hook);
+        insert_(hook);
+    }
+}
+
+void TimeWheel::expire_(int index) {
+    while (heads_[index]) {
+        TimerHook* hook = heads_[index];
+        unlink_(hook);
+        link_(hook, EXPIRED);
+    }
+    // 回调里可能会 add/adjust/cancel 任意节点, 所以每次只取链表头
+    while (heads_[EXPIRED]) {
+        TimerHook* hook = heads_[EXPIRED];
+        unlink_(hook);
+        size_--;
+        if (hook->cb) hook->cb(hook->ctx, hook->arg);
+    }
+}
+
+void TimeWheel::add(TimerHook* hook, int timeoutMs) {
+    assert(hook);
+    if (hook->linked()) {
+        // 已有节点, 重新调整
+        unlink_(hook);
+    } else {
+        size_++;
+    }
+    hook->expires = nowMs_() + timeoutMs;
+    insert_(hook);
+}
+
+void TimeWheel::adjust(TimerHook* hook, int timeoutMs) {
+    assert(hook && hook->linked());
+    unlink_(hook);
+    hook->expires = nowMs_() + timeoutMs;
+    insert_(hook);
+}
+
+void TimeWheel::cancel(TimerHook* hook) {
+    assert(hook);
+    if (!hook->linked()) return;
+    unlink_(hook);
+    size_--;
+}
+
+void TimeWheel::RunIdTimer_(void* ctx, void* arg) {
+    IdTimer* timer = static_cast<IdTimer*>(ctx);
+    // 回调里可能重新 add 同一个 id, 先把回调移出来
+    TimeoutCallBack cb = std::move(timer->cb);
+    if (cb) cb();
+}
+
+TimeWheel::IdTimer* TimeWheel::idTimer_(int id) const {
+    assert(id >= 0);
+    if (static_cast<size_t>(id) >= idTimers_.size()) return nullptr;
+    return idTimers_[id].get();
+}
+
+void TimeWheel::adjust(int id, int timeoutMs) {
+    IdTimer* timer = idTimer_(id);
+    assert(timer);
+    adjust(&timer->hook, timeoutMs);
+}
+
+void TimeWheel::add(int id, int timeoutMs, TimeoutCallBack cb) {
+    assert(id >= 0);
+    if (static_cast<size_t>(id) >= idTimers_.size()) {
+        idTimers_.resize(max(static_cast<size_t>(id) + 1, idTimers_.size() * 2));
+    }
+    if (!idTimers_[id]) {
+        idTimers_[id] = make_unique<IdTimer>();
+        idTimers_[id]->hook.cb = RunIdTimer_;
+        idTimers_[id]->hook.ctx = idTimers_[id].get();
+    }
+    idTimers_[id]->cb = std::move(cb);
+    add(&idTimers_[id]->hook, timeoutMs);
+}
+
+void TimeWheel::doWork(int id) {
+    IdTimer* timer = idTimer_(id);
+    if (!timer || !timer->hook.linked()) {
+        return;
+    }
+    cancel(&timer->hook);
+    RunIdTimer_(timer, nullptr);
+}
+
+void TimeWheel::cancel(int id) {
+    IdTimer* timer = idTimer_(id);
+    if (!timer || !timer->hook.linked()) {
+        return;
+    }
+    cancel(&timer->hook);
+    timer->cb = nullptr;
+}
+
+void TimeWheel::clear() {
+    for (TimerHook*& head : heads_) {
+        while (head) {
+            unlink_(head);
+        }
+    }
+    fill(begin(occupied_), end(occupied_), 0);
+    size_ = 0;
+    idTimers_.clear();
+}
+
+void TimeWheel::tick() {
+    uint64_t target = nowMs_();
+    if (empty()) {
+        current_ = max(current_, target);
+        return;
+    }
+    while (current_ < target) {
+        // 下一个需要处理的时刻: 第 0 层下一个非空槽, 或者下一次级联
+        uint64_t next = (current_ | SLOT_MASK) + 1;
+        if (occupied_[0]) {
+            uint64_t bits = RotateRight(occupied_[0], (current_ + 1) & SLOT_MASK);
+            next = min(next, current_ + 1 + __builtin_ctzll(bits));
+        }
+        if (next > target) {
+            current_ = target;
+            break;
+        }
+        current_ = next;
+        if ((current_ & SLOT_MASK) == 0) {
+            for (int level = 1; level < LEVELS; level++) {
+                int index = (current_ >> (SLOT_BITS * level)) & SLOT_MASK;
+                cascade_(level, index);
+                if (index != 0) break;
+            }
+        }
+        expire_(current_ & SLOT_MASK);
+    }
+}
+
+int TimeWheel::getNextTickMs() {
+    tick();
+    if (empty()) return -1;
+    uint64_t next = UINT64_MAX;
+    for (int level = 0; level < LEVELS; level++) {
+        if (!occupied_[level]) continue;
+        // 高层的槽到级联时刻就需要醒来, 级联后再精确计算
+        uint64_t cur = current_ >> (SLOT_BITS * level);
+        uint64_t bits = RotateRight(occupied_[level], (cur + 1) & SLOT_MASK);
+        uint64_t when = (cur + 1 + __builtin_ctzll(bits)) << (SLOT_BITS * level);
+        next = min(next, when);
+    }
+    uint64_t now = nowMs_();
+    if (next <= now) return 0;
+    return static_cast<int>(min<uint64_t>(next - now, INT_MAX));
+}
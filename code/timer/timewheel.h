@@ -0,0 +1,104 @@
+#ifndef _TIMEWHEEL_H_
+#define _TIMEWHEEL_H_
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+#include "heaptimer.h"
+#include "timerhook.h"
+
+// 分层时间轮, 接口与 HeapTimer 一致
+// 4 层, 每层 64 个槽, 第 L 层一个槽跨 64^L 毫秒, 最多覆盖 64^4 ms (约 4.6 小时)
+// add/adjust/cancel 都是 O(1), 到期的节点按槽批量处理
+//
+// 槽链表直接串 TimerHook, 宿主对象自带节点时用 TimerHook* 接口, 不分配内存;
+// 按 id 的接口在内部为每个 id 维护一个节点, 兼容 HeapTimer 的用法
+class TimeWheel {
+public:
+    TimeWheel();
+
+    ~TimeWheel() {
+        clear();
+    }
+
+    // 侵入式接口, hook 的 cb/ctx/arg 由调用方填好, 节点在链表中时不能销毁
+    // 已在时间轮中的节点会重新计时
+    void add(TimerHook* hook, int timeoutMs);
+
+    void adjust(TimerHook* hook, int timeoutMs);
+
+    // 从时间轮中摘下, 不调用回调
+    void cancel(TimerHook* hook);
+
+    // 重新调整超时时间
+    void adjust(int id, int newTimeOutMs);
+
+    // 添加一个新的计时器, id 已存在时替换回调并重新计时
+    void add(int id, int timeoutMs, TimeoutCallBack cb);
+
+    // 调用回调函数并删除节点
+    void doWork(int id);
+
+    // 删除节点, 不调用回调
+    void cancel(int id);
+
+    // 清空所有计时器
+    void clear();
+
+    // 推进到当前时间, 处理所有到期节点
+    void tick();
+
+    // 获取下一次需要醒来的时间, 没有计时器时返回 -1
+    int getNextTickMs();
+
+    size_t size() { return size_; };
+
+    bool empty() { return size() == 0; }
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const int SLOT_MASK = SLOTS - 1;
+    // 正在执行回调的节点所在的链表
+    static const int EXPIRED = LEVELS * SLOTS;
+
+    // 按 id 添加的计时器, 节点地址要稳定, 所以单独分配
+    struct IdTimer {
+        TimerHook hook;
+        TimeoutCallBack cb;
+    };
+
+    static void RunIdTimer_(void* ctx, void* arg);
+
+    IdTimer* idTimer_(int id) const;
+
+    uint64_t nowMs_() const;
+
+    void insert_(TimerHook* hook);
+
+    void link_(TimerHook* hook, int slot);
+
+    void unlink_(TimerHook* hook);
+
+    // 把第 level 层 slot 槽里的节点重新放到更低的层
+    void cascade_(int level, int slot);
+
+    // 把 slot 槽里的节点全部移到 EXPIRED 链表并依次执行
+    void expire_(int slot);
+
+    TimeStamp start_;
+    // 时间轮已经处理到的时刻, 相对 start_ 的毫秒数
+    uint64_t current_;
+    size_t size_;
+
+    TimerHook* heads_[LEVELS * SLOTS + 1];
+    // 每层一个位图, 标记哪些槽非空
+    uint64_t occupied_[LEVELS];
+
+    std::vector<std::unique_ptr<IdTimer>> idTimers_;
+};
+
+#endif
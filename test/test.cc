@@ -2,22 +2,88 @@
 #include "../code/pool/sqlconnpool.h"
 #include "../code/pool/sqlconnRAII.h"
 #include "../code/timer/heaptimer.h"
+#include "../code/timer/timewheel.h"
 #include "../code/log/blockingqueue.h"
 #include "../code/log/log.h"
 #include "../code/buffer/buffer.h"
 #include "../code/http/httprequest.h"
 #include "../code/http/httpresponse.h"
 #include "../code/http/httpconn.h"
+#include "../code/http/httpscan.h"
+#include "../code/http/filecache.h"
 #include "../code/server/epoller.h"
 #include "../code/server/webserver.h"
+#include "../code/server/conntable.h"
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <memory>
 #include <chrono>
 #include <mutex>
+#include <random>
+#include <regex>
+#include <queue>
+#include <set>
 
 using namespace std;
 
+// 统计 AllocCounter 存在期间的堆分配次数, 其余时间只转发给 malloc/free
+// 替换了全部形式的 operator new/delete, 数组、带大小、按对齐的版本都走同一套, 不会混用
+static atomic<bool> countAllocs{false};
+static atomic<size_t> allocCount{0};
+
+class AllocCounter {
+public:
+    AllocCounter(): start_(allocCount.load()) { countAllocs = true; }
+    ~AllocCounter() { countAllocs = false; }
+    size_t count() const { return allocCount.load() - start_; }
+private:
+    size_t start_;
+};
+
+static void* CountedAlloc(size_t size, size_t align) noexcept {
+    if (countAllocs.load(memory_order_relaxed)) allocCount.fetch_add(1, memory_order_relaxed);
+    if (size == 0) size = 1;
+    if (align <= alignof(max_align_t)) return malloc(size);
+    return aligned_alloc(align, (size + align - 1) / align * align);
+}
+
+static void* CountedNew(size_t size, size_t align) {
+    if (void* p = CountedAlloc(size, align)) return p;
+    throw bad_alloc();
+}
+
+// 不内联, 编译器看不到 free 和 operator new 的配对, 不会误报 -Wmismatched-new-delete
+__attribute__((noinline)) static void CountedFree(void* p) noexcept {
+    free(p);
+}
+
+void* operator new(size_t size) { return CountedNew(size, 0); }
+void* operator new[](size_t size) { return CountedNew(size, 0); }
+void* operator new(size_t size, const nothrow_t&) noexcept { return CountedAlloc(size, 0); }
+void* operator new[](size_t size, const nothrow_t&) noexcept { return CountedAlloc(size, 0); }
+void* operator new(size_t size, align_val_t align) { return CountedNew(size, static_cast<size_t>(align)); }
+void* operator new[](size_t size, align_val_t align) { return CountedNew(size, static_cast<size_t>(align)); }
+void* operator new(size_t size, align_val_t align, const nothrow_t&) noexcept {
+    return CountedAlloc(size, static_cast<size_t>(align));
+}
+void* operator new[](size_t size, align_val_t align, const nothrow_t&) noexcept {
+    return CountedAlloc(size, static_cast<size_t>(align));
+}
+
+void operator delete(void* p) noexcept { CountedFree(p); }
+void operator delete[](void* p) noexcept { CountedFree(p); }
+void operator delete(void* p, size_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, size_t) noexcept { CountedFree(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { CountedFree(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { CountedFree(p); }
+void operator delete(void* p, align_val_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, align_val_t) noexcept { CountedFree(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { CountedFree(p); }
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept { CountedFree(p); }
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept { CountedFree(p); }
+
 class Timer {
 public:
     using Clock = chrono::steady_clock;
@@ -44,6 +110,366 @@ void TestThreadPool() {
         });
     }
     std::this_thread::sleep_for(chrono::milliseconds(300));
+    {
+        // 多个线程同时提交, 任务里再提交子任务(放进工作线程自己的队列), 每个任务都执行且只执行一次
+        const int producers = 4, perProducer = 20000;
+        atomic<int> done = 0;
+        vector<atomic<int>> runs(producers * perProducer * 2);
+        {
+            ThreadPool stealing(6);
+            vector<thread> threads;
+            for (int p = 0; p < producers; p++) {
+                threads.emplace_back([&, p] {
+                    for (int i = 0; i < perProducer; i++) {
+                        int id = (p * perProducer + i) * 2;
+                        stealing.AddTask([&, id] {
+                            runs[id]++;
+                            done++;
+                            stealing.AddTask([&, id] {
+                                runs[id + 1]++;
+                                done++;
+                            });
+                        });
+                    }
+                });
+            }
+            for (auto& t : threads) t.join();
+            while (done < producers * perProducer * 2) this_thread::yield();
+        }
+        for (auto& n : runs) assert(n == 1);
+        cout << "work stealing tasks: " << done << endl;
+    }
+    {
+        // 无锁提交队列: 满了拒绝, 批量放入只放得下的部分; 多生产者多消费者下每个元素取出且只取出一次
+        MpmcQueue<int> queue;
+        const size_t cap = MpmcQueue<int>::CAPACITY;
+        vector<int> values(cap + 10);
+        vector<int*> ptrs;
+        for (auto& v : values) ptrs.push_back(&v);
+        assert(queue.pop() == nullptr);
+        assert(queue.push(ptrs[0]));
+        assert(queue.pushBatch(ptrs.data() + 1, cap + 9) == cap - 1);
+        assert(queue.size() == cap);
+        assert(!queue.push(ptrs[cap]));
+        assert(queue.pushBatch(ptrs.data() + cap, 1) == 0);
+        for (size_t i = 0; i < cap; i++) assert(queue.pop() == ptrs[i]);
+        assert(queue.pop() == nullptr && queue.size() == 0);
+
+        const int producers = 4, consumers = 4, perProducer = 200000;
+        vector<int> items(producers * perProducer);
+        vector<atomic<int>> seen(items.size());
+        atomic<int> popped = 0;
+        vector<thread> threads;
+        for (int p = 0; p < producers; p++) {
+            threads.emplace_back([&, p] {
+                int* base = items.data() + p * perProducer;
+                for (int i = 0; i < perProducer;) {
+                    // 交替单个和批量放入
+                    int n = min(i % 3 == 0 ? 1 : 37, perProducer - i);
+                    int* batch[37];
+                    for (int k = 0; k < n; k++) batch[k] = base + i + k;
+                    size_t pushed = n == 1 ? queue.push(batch[0]) : queue.pushBatch(batch, n);
+                    if (pushed == 0) this_thread::yield();
+                    i += pushed;
+                }
+            });
+        }
+        for (int c = 0; c < consumers; c++) {
+            threads.emplace_back([&] {
+                while (popped < static_cast<int>(items.size())) {
+                    if (int* item = queue.pop()) {
+                        seen[item - items.data()]++;
+                        popped++;
+                    } else {
+                        this_thread::yield();
+                    }
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+        for (auto& n : seen) assert(n == 1);
+        cout << "mpmc queue items: " << popped << endl;
+    }
+    {
+        // 批量提交: 一批比提交队列还大时多出来的放进溢出链表, 任务都执行且只执行一次
+        const int batches = 20, perBatch = 10000;
+        vector<atomic<int>> runs(batches * perBatch);
+        atomic<int> done = 0;
+        {
+            ThreadPool pool(4);
+            ThreadPool::Batch batch(pool);
+            for (int b = 0; b < batches; b++) {
+                for (int i = 0; i < perBatch; i++) {
+                    batch.add([&, id = b * perBatch + i] {
+                        runs[id]++;
+                        done++;
+                    });
+                }
+                assert(batch.size() == perBatch);
+                batch.submit();
+                assert(batch.size() == 0);
+            }
+            while (done < batches * perBatch) this_thread::yield();
+        }
+        for (auto& n : runs) assert(n == 1);
+        cout << "batched tasks: " << done << endl;
+    }
+    {
+        // 弹性线程数: 任务都阻塞着还有任务排队时补充到上限, 空闲一个冷却期后逐个收缩回下限
+        // 析构时已提交的任务都执行完, 线程都 join
+        const int idleMs = 100;
+        atomic<int> done = 0;
+        {
+            ThreadPool elastic(1, 4, idleMs);
+            assert(elastic.threadCount() == 1);
+            auto start = chrono::steady_clock::now();
+            for (int i = 0; i < 8; i++) {
+                elastic.AddTask([&done] {
+                    ThreadPool::BlockingScope blocking;
+                    this_thread::sleep_for(chrono::milliseconds(100));
+                    done++;
+                });
+            }
+            while (done < 8) this_thread::yield();
+            auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+            assert(elastic.threadCount() == 4);
+            // 1 个线程要 800ms
+            assert(ms < 500);
+            for (int i = 0; i < 50 && elastic.threadCount() > 1; i++) {
+                this_thread::sleep_for(chrono::milliseconds(idleMs));
+            }
+            assert(elastic.threadCount() == 1);
+            cout << "elastic: 8 blocking tasks in " << ms << " ms, shrunk to " << elastic.threadCount() << endl;
+            // 收缩后还能再补充; 没有声明阻塞的任务靠排队时间触发
+            for (int i = 0; i < 8; i++) {
+                elastic.AddTask([&done] {
+                    this_thread::sleep_for(chrono::milliseconds(20));
+                    done++;
+                });
+            }
+            while (done < 12) this_thread::yield();
+            assert(elastic.threadCount() > 1);
+        }
+        assert(done == 16);
+    }
+    {
+        // 连接亲和: 没有积压时同一个 key 的任务都在同一个线程执行, 不同的 key 分到不同的线程
+        ThreadPool pool(4);
+        const int keys = 16;
+        vector<thread::id> owner(keys);
+        bool sameThread = true;
+        for (int round = 0; round < 50; round++) {
+            for (int key = 0; key < keys; key++) {
+                atomic<bool> ran = false;
+                pool.AddTask(key, [&, key] {
+                    if (round == 0) owner[key] = this_thread::get_id();
+                    else if (owner[key] != this_thread::get_id()) sameThread = false;
+                    ran = true;
+                });
+                while (!ran) this_thread::yield();
+            }
+        }
+        assert(sameThread);
+        set<thread::id> threads(owner.begin(), owner.end());
+        assert(threads.size() == 4);
+
+        // 所属线程被占住时, 积压的任务由别的线程窃取
+        atomic<bool> release = false;
+        atomic<int> done = 0;
+        pool.AddTask(0, [&] {
+            while (!release) this_thread::yield();
+        });
+        for (int i = 0; i < 10; i++) {
+            pool.AddTask(0, [&] { done++; });
+        }
+        while (done < 10) this_thread::yield();
+        release = true;
+
+        // 批量提交混合有 key 和没有 key 的任务, 每个都执行且只执行一次
+        const int total = 100000;
+        vector<atomic<int>> runs(total);
+        atomic<int> finished = 0;
+        {
+            ThreadPool::Batch batch(pool);
+            for (int i = 0; i < total; i++) {
+                auto task = [&, i] {
+                    runs[i]++;
+                    finished++;
+                };
+                if (i % 3 == 0) batch.add(task);
+                else batch.add(i % 100, task);
+                if (i % 500 == 499) batch.submit();
+            }
+        }
+        while (finished < total) this_thread::yield();
+        for (auto& n : runs) assert(n == 1);
+        cout << "affine tasks on " << threads.size() << " threads, batched: " << finished << endl;
+    }
+    {
+        // 一个线程, 任务一直排着队, 最小排队时间超过目标后过载; 队列排空后两个窗口内恢复
+        ThreadPool single(1, 1);
+        atomic<int> left(40);
+        for (int i = 0; i < 40; i++) {
+            single.AddTask([&] {
+                this_thread::sleep_for(chrono::milliseconds(10));
+                left--;
+            });
+        }
+        bool over = false;
+        while (left > 0) {
+            over = over || single.overloaded();
+            this_thread::sleep_for(chrono::milliseconds(5));
+        }
+        assert(over);
+        this_thread::sleep_for(chrono::nanoseconds(2 * ThreadPool::SHED_INTERVAL_NS + 10000000));
+        assert(!single.overloaded());
+        cout << "overloaded while queued, recovered after drain" << endl;
+    }
+    {
+        // 指定 CPU 时工作线程绑定在上面
+        atomic<int> cpuCount = -1, cpu = -1;
+        {
+            ThreadPool pinned(1, 1, ThreadPool::IDLE_TIMEOUT_MS, {0});
+            pinned.AddTask([&] {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                sched_getaffinity(0, sizeof(set), &set);
+                cpu = sched_getcpu();
+                cpuCount = CPU_COUNT(&set);
+            });
+        }
+        assert(cpuCount == 1 && cpu == 0);
+    }
+    {
+        // Task 只能移动, 捕获的对象随最后一个 Task 析构, 不会多析构也不会漏
+        auto counter = make_shared<int>(0);
+        {
+            Task a([counter] { (*counter)++; });
+            assert(counter.use_count() == 2);
+            Task b(std::move(a));
+            assert(!a && b && counter.use_count() == 2);
+            b();
+            a = std::move(b);
+            a();
+            assert(*counter == 2 && counter.use_count() == 2);
+            a = nullptr;
+            assert(counter.use_count() == 1);
+            a = [counter] { (*counter)++; };
+        }
+        assert(counter.use_count() == 1);
+        static_assert(sizeof(Task) <= 64, "Task should fit in a cache line");
+    }
+    {
+        // 预热之后, 从 Reactor 线程提交并执行任务不再分配内存
+        // 同时在队列里的任务数有上限, 和 Reactor 一样, 节点数只和这个峰值有关
+        ThreadPool pool(4);
+        atomic<int> done = 0;
+        auto run = [&](int n) {
+            done = 0;
+            for (int i = 0; i < n; i++) {
+                while (i - done > 1000) this_thread::yield();
+                pool.AddTask([&done, i, p = &pool] { done += (i >= 0 && p); });
+            }
+            while (done < n) this_thread::yield();
+        };
+        run(100000);
+        size_t allocs;
+        {
+            AllocCounter counter;
+            run(100000);
+            allocs = counter.count();
+        }
+        cout << "allocations for 100000 tasks: " << allocs << endl;
+        assert(allocs < 100);
+    }
+}
+
+// 原来的线程池: 一个队列, 一把锁, 一个条件变量, 作为对比
+class MutexThreadPool {
+public:
+    explicit MutexThreadPool(size_t threadCount): pool_(make_shared<Pool>()) {
+        for (size_t i = 0; i < threadCount; i++) {
+            thread([pool = pool_] {
+                unique_lock<mutex> locker(pool->mtx);
+                while (true) {
+                    if (!pool->tasks.empty()) {
+                        auto task = pool->tasks.front();
+                        pool->tasks.pop();
+                        locker.unlock();
+                        task();
+                        locker.lock();
+                    } else if (pool->isClosed) {
+                        break;
+                    } else {
+                        pool->cond.wait(locker);
+                    }
+                }
+            }).detach();
+        }
+    }
+
+    ~MutexThreadPool() {
+        {
+            lock_guard<mutex> locker(pool_->mtx);
+            pool_->isClosed = true;
+        }
+        pool_->cond.notify_all();
+    }
+
+    template <typename F>
+    void AddTask(F&& task) {
+        {
+            lock_guard<mutex> locker(pool_->mtx);
+            pool_->tasks.emplace(std::forward<F>(task));
+        }
+        pool_->cond.notify_one();
+    }
+
+private:
+    struct Pool {
+        mutex mtx;
+        condition_variable cond;
+        bool isClosed = false;
+        queue<function<void()>> tasks;
+    };
+    shared_ptr<Pool> pool_;
+};
+
+// producers 个线程一共提交 tasks 个小任务(模拟 Reactor 分发的读写事件), 计算全部执行完的时间
+template <typename T>
+void BenchThreadPoolRun(const char* name, int threads, int producers, int tasks) {
+    atomic<int> done = 0;
+    auto start = chrono::steady_clock::now();
+    {
+        T pool(threads);
+        vector<thread> submitters;
+        for (int p = 0; p < producers; p++) {
+            submitters.emplace_back([&pool, &done, n = tasks / producers] {
+                for (int i = 0; i < n; i++) {
+                    pool.AddTask([&done] {
+                        volatile uint64_t x = 0;
+                        for (int k = 0; k < 100; k++) x = x + k;
+                        done.fetch_add(1, memory_order_relaxed);
+                    });
+                }
+            });
+        }
+        for (auto& t : submitters) t.join();
+        while (done.load() < tasks / producers * producers) this_thread::yield();
+    }
+    auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    cout << name << ": " << threads << " threads, " << producers << " producers, "
+         << us / 1000 << " ms, " << static_cast<long long>(tasks) * 1000 / max<long long>(us, 1) << " Ktasks/s" << endl;
+}
+
+void BenchThreadPool() {
+    cout << "=================Benchmark MutexThreadPool vs ThreadPool=================" << endl;
+    for (int threads : {6, 8, 16, 32, 64}) {
+        for (int producers : {1, 4}) {
+            BenchThreadPoolRun<MutexThreadPool>("MutexThreadPool", threads, producers, 1000000);
+            BenchThreadPoolRun<ThreadPool>("ThreadPool     ", threads, producers, 1000000);
+        }
+    }
 }
 
 void TestSqlPool() {
@@ -126,6 +552,137 @@ void TestHeapTimer() {
         ht->tick();
         assert(ht->empty());
     }
+    {
+        // id 槽位用过一次之后, 反复添加、触发、删除计时器都不分配内存
+        HeapTimer ht(16);
+        int fired = 0;
+        for (int id = 0; id < 1000; id++) ht.add(id, 60000, [&fired] { fired++; });
+        ht.clear();
+        size_t allocs;
+        {
+            AllocCounter counter;
+            for (int round = 0; round < 100; round++) {
+                for (int id = 0; id < 1000; id++) ht.add(id, 60000 + id, [&fired] { fired++; });
+                for (int id = 0; id < 1000; id += 2) ht.doWork(id);
+                ht.clear();
+            }
+            allocs = counter.count();
+        }
+        assert(fired == 100 * 500 && ht.empty());
+        cout << "heap timer allocations after warm-up: " << allocs << endl;
+        assert(allocs == 0);
+    }
+}
+
+void TestTimeWheel() {
+    {
+        cout << "=================Testing TimeWheel1=================" << endl;
+        unique_ptr<TimeWheel> tw = make_unique<TimeWheel>();
+        tw->add(1, 100, [] { cout << "timer 1 finished\n"; });
+        tw->add(2, 50, [] { cout << "timer 2 finished\n"; });
+        tw->add(3, 10, [] { cout << "timer 3 should not run\n"; assert(false); });
+        tw->cancel(3);
+        assert(tw->size() == 2);
+        cout << "# sleep for 75 ms\n";
+        std::this_thread::sleep_for(chrono::milliseconds(75));
+        int nextTickMs = tw->getNextTickMs();
+        cout << "nextTickMs: " << nextTickMs << endl;
+        assert(tw->size() == 1);
+        cout << "# sleep for 75 ms\n";
+        std::this_thread::sleep_for(chrono::milliseconds(75));
+        nextTickMs = tw->getNextTickMs();
+        cout << "nextTickMs: " << nextTickMs << endl;
+        assert(nextTickMs == -1);
+        assert(tw->empty());
+    }
+    {
+        cout << "=================Testing TimeWheel2=================" << endl;
+        // 随机超时跨越多层, 检查每个节点都不早于、也不明显晚于到期时间
+        TimeWheel tw;
+        mt19937 rng(1316);
+        const int n = 2000;
+        vector<chrono::steady_clock::time_point> expires(n);
+        vector<int> lateMs(n, -1);
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            int timeoutMs = rng() % 700;
+            expires[i] = start + chrono::milliseconds(timeoutMs);
+            tw.add(i, timeoutMs, [i, &expires, &lateMs] {
+                lateMs[i] = chrono::duration_cast<chrono::milliseconds>(
+                    chrono::steady_clock::now() - expires[i]).count();
+            });
+        }
+        // 一部分延长, 一部分提前执行
+        for (int i = 0; i < n; i += 10) {
+            tw.adjust(i, 300);
+            expires[i] = chrono::steady_clock::now() + chrono::milliseconds(300);
+        }
+        tw.doWork(1);
+        assert(lateMs[1] != -1);
+        lateMs[1] = 0;
+        while (!tw.empty()) {
+            int nextTickMs = tw.getNextTickMs();
+            if (nextTickMs > 0) std::this_thread::sleep_for(chrono::milliseconds(nextTickMs));
+        }
+        int maxLate = 0;
+        for (int i = 0; i < n; i++) {
+            assert(lateMs[i] >= 0);
+            maxLate = max(maxLate, lateMs[i]);
+        }
+        cout << "max late ms: " << maxLate << endl;
+        assert(maxLate < 20);
+    }
+    {
+        cout << "=================Testing TimeWheel3=================" << endl;
+        // 侵入式节点: 回调是函数指针加上下文
+        TimeWheel tw;
+        int fired = 0;
+        TimerHook hooks[3];
+        for (TimerHook& hook : hooks) {
+            hook.cb = [](void* ctx, void* arg) { (*static_cast<int*>(ctx))++; };
+            hook.ctx = &fired;
+            tw.add(&hook, 20);
+        }
+        tw.cancel(&hooks[0]);
+        assert(!hooks[0].linked() && tw.size() == 2);
+        tw.add(&hooks[1], 100);
+        assert(tw.size() == 2);
+        std::this_thread::sleep_for(chrono::milliseconds(50));
+        tw.tick();
+        assert(fired == 1 && !hooks[2].linked());
+        std::this_thread::sleep_for(chrono::milliseconds(60));
+        tw.tick();
+        assert(fired == 2 && tw.empty());
+    }
+}
+
+// 模拟长连接: n 个连接各自一个计时器, 每次事件都刷新一个随机连接的超时
+template <typename T>
+void BenchTimerChurn(const char* name, int n, int ops) {
+    T timer;
+    mt19937 rng(1316);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        timer.add(i, 60000, [] {});
+    }
+    for (int i = 0; i < ops; i++) {
+        timer.adjust(rng() % n, 60000 - static_cast<int>(rng() % 1000));
+        if ((i & 1023) == 0) timer.getNextTickMs();
+    }
+    for (int i = 0; i < n; i++) {
+        timer.doWork(i);
+    }
+    auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    cout << name << ": " << n << " timers, " << ops << " adjusts, " << us / 1000 << " ms, "
+         << us * 1000 / ops << " ns/op" << endl;
+}
+
+void BenchTimer() {
+    cout << "=================Benchmark HeapTimer vs TimeWheel=================" << endl;
+    for (int n : {1000, 50000}) {
+        BenchTimerChurn<HeapTimer>("HeapTimer", n, 2000000);
+        BenchTimerChurn<TimeWheel>("TimeWheel", n, 2000000);
+    }
 }
 
 void TestBlockingQueue() {
@@ -248,7 +805,7 @@ void TestHttpRequestGetLine() {
     }).detach();
     buff.readFd(p[0], &err);
     
-    string line;
+    string_view line;
     HttpRequest::LINE_STATE lineState = req.getLine(buff, line);
     assert(lineState == HttpRequest::LINE_OK);
     assert(line == "line1");
@@ -297,6 +854,247 @@ void TestHttpRequestParse() {
         cout << "password in post: " << req.getPost("password") << endl;
         cout << "arg in post: " << req.getPost("arg") << endl;
     }
+    {
+        // 非法输入要和原来的正则解析得到相同的结果
+        vector<pair<string, HttpRequest::HTTP_CODE>> cases = {
+            {"GET / HTTP/1.1\r\n\r\n", HttpRequest::GET_REQUEST},
+            {"GET /index HTTP/1.1\r\nHost:x\r\nEmpty:\r\n\r\n", HttpRequest::GET_REQUEST},
+            // 头部名必须是非空的 token, 和冒号之间不能有空白
+            {"GET / HTTP/1.1\r\nX-a_b.c~!#$%&'*+^`|9: v\r\n\r\n", HttpRequest::GET_REQUEST},
+            {"GET / HTTP/1.1\r\n:novalue\r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"GET / HTTP/1.1\r\nBad Name: x\r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"GET / HTTP/1.1\r\nHost : x\r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"GET / HTTP/1.1\r\nX(y): x\r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"GET / HTTP/1.1\r\nNa\xc3\xa9me: x\r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"GET  / HTTP/1.1\r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"G3T / HTTP/1.1\r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"GET / HTTP/\r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"GET / HTTP/1.1 \r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"GET / FTP/1.1\r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"GET /\r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"GET / HTTP/1.1\r\nNoColon\r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"GET / HTTP/1.1\r\nBad: a\nb\r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"GET / HTTP/1.1\r\nContent-Length: abc\r\n\r\n", HttpRequest::BAD_REQUEST},
+            {"GET / HTTP/1.1\r\nHost: x\r\n", HttpRequest::NO_REQUEST},
+            {"POST /x HTTP/1.1\r\nContent-Length: 5\r\n\r\nab", HttpRequest::NO_REQUEST},
+        };
+        for (auto& [text, expected] : cases) {
+            HttpRequest req;
+            Buffer buff;
+            buff.append(text);
+            assert(req.parse(buff) == expected);
+        }
+    }
+    {
+        // 请求按任意位置拆成多次读入, 结果要和一次读完相同, \r 和 \n 被拆开也要能识别
+        string s("POST /login HTTP/1.1\r\n"
+                 "Content-Length: 9\r\n"
+                 "Connection: keep-alive\r\n"
+                 "\r\n"
+                 "a=1&b=2&c");
+        for (size_t step = 1; step <= 7; step++) {
+            HttpRequest req;
+            Buffer buff;
+            HttpRequest::HTTP_CODE code = HttpRequest::NO_REQUEST;
+            for (size_t i = 0; i < s.size(); i += step) {
+                assert(code == HttpRequest::NO_REQUEST);
+                buff.append(s.substr(i, step));
+                code = req.parse(buff);
+            }
+            assert(code == HttpRequest::GET_REQUEST);
+            assert(req.getMainState() == HttpRequest::FINISH);
+            assert(req.path() == "/login.html");
+            assert(req.isKeepAlive());
+            assert(req.body() == "a=1&b=2&c");
+            assert(buff.readableBytes() == 0);
+        }
+        // 上一个请求解析完后再 parse 会从新请求开始
+        HttpRequest req;
+        Buffer buff;
+        buff.append("GET /a HTTP/1.1\r\n\r\n");
+        assert(req.parse(buff) == HttpRequest::GET_REQUEST);
+        buff.append("GET /b HTTP/1.0\r\n\r\n");
+        assert(req.parse(buff) == HttpRequest::GET_REQUEST);
+        assert(req.path() == "/b" && req.version() == "1.0");
+    }
+    {
+        // 首部表: 不区分大小写, 超过内联容量, 同名取最后一个
+        string s("GET / HTTP/1.1\r\n"
+                 "content-length: 0\r\n"
+                 "CONNECTION: keep-alive\r\n");
+        for (int i = 0; i < HeaderTable::INLINE_CAPACITY + 4; i++) {
+            s += "X-Extra-" + to_string(i) + ": v" + to_string(i) + "\r\n";
+        }
+        s += "x-extra-3: last\r\nEmpty:\r\n\r\n";
+        HttpRequest req;
+        Buffer buff;
+        buff.append(s);
+        assert(req.parse(buff) == HttpRequest::GET_REQUEST);
+        assert(req.isKeepAlive());
+        assert(req.getHeader(HttpHeader::CONTENT_LENGTH) == "0");
+        assert(req.getHeader("Content-Length") == "0");
+        assert(req.getHeader("X-EXTRA-19") == "v19");
+        assert(req.getHeader("X-Extra-3") == "last");
+        assert(req.getHeader("Empty").data() != nullptr && req.getHeader("Empty").empty());
+        assert(req.getHeader("Missing").data() == nullptr);
+        assert(req.getHeader(HttpHeader::HOST).data() == nullptr);
+        assert(HttpHeader::Lookup("if-none-match") == HttpHeader::IF_NONE_MATCH);
+        assert(HttpHeader::Lookup("Content-Lengtx") == HttpHeader::UNKNOWN);
+        assert(!HttpHeader::EqualsIgnoreCase("a-b", "a\rb"));
+    }
+    {
+        // Accept-Encoding 协商
+        vector<pair<string, bool>> cases = {
+            {"gzip, deflate, br", true},
+            {"deflate, GZIP;q=0.5", true},
+            {"gzip;q=0", false},
+            {"gzip; q=0.000, *", false},
+            {"br, *", true},
+            {"*;q=0", false},
+            {"identity", false},
+            {"xgzip", false},
+            {"", false},
+        };
+        for (auto& [value, expected] : cases) {
+            HttpRequest req;
+            Buffer buff;
+            buff.append("GET / HTTP/1.1\r\nAccept-Encoding: " + value + "\r\n\r\n");
+            assert(req.parse(buff) == HttpRequest::GET_REQUEST);
+            assert(req.acceptsEncoding("gzip") == expected);
+        }
+    }
+}
+
+void TestHttpScan() {
+    cout << "=================Testing HttpScan=================" << endl;
+    HttpScan::Level origin = HttpScan::GetLevel();
+    mt19937 rng(1316);
+    const char alphabet[] = "aZ:\r\n -9";
+    for (HttpScan::Level level : {HttpScan::SCALAR, HttpScan::SSE42, HttpScan::AVX2}) {
+        if (!HttpScan::SetLevel(level)) {
+            cout << "level " << level << " not supported" << endl;
+            continue;
+        }
+        cout << "checking " << HttpScan::GetLevelName() << endl;
+        for (int round = 0; round < 20000; round++) {
+            // 大部分是字母, 偶尔出现分隔符, 长度覆盖整块和尾部
+            string s(rng() % 100, 'a');
+            for (char& ch : s) {
+                if (rng() % 20 == 0) ch = alphabet[rng() % (sizeof(alphabet) - 1)];
+            }
+            const char* begin = s.data();
+            const char* end = s.data() + s.size();
+            size_t crlf = s.find("\r\n");
+            size_t crOrLf = s.find_first_of("\r\n");
+            size_t alpha = 0;
+            while (alpha < s.size() && isalpha(static_cast<unsigned char>(s[alpha]))) alpha++;
+            assert(HttpScan::FindCrlf(begin, end) == (crlf == string::npos ? end : begin + crlf));
+            assert(HttpScan::FindCrOrLf(begin, end) == (crOrLf == string::npos ? end : begin + crOrLf));
+            assert(HttpScan::SkipAlpha(begin, end) == begin + alpha);
+        }
+        // tchar 的判断覆盖全部 256 个字节值, 每个字节放在块内不同位置
+        const string tchars = "!#$%&'*+-.^_`|~0123456789"
+                              "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+        for (int ch = 0; ch < 256; ch++) {
+            bool isToken = ch != 0 && tchars.find(static_cast<char>(ch)) != string::npos;
+            for (size_t pos : {0, 5, 15, 16, 31, 32, 40}) {
+                string s(48, 'a');
+                s[pos] = static_cast<char>(ch);
+                const char* begin = s.data();
+                const char* end = s.data() + s.size();
+                assert(HttpScan::SkipToken(begin, end) == (isToken ? end : begin + pos));
+            }
+        }
+    }
+    HttpScan::SetLevel(origin);
+}
+
+void BenchHttpScan() {
+    cout << "=================Benchmark HttpScan=================" << endl;
+    // 模拟浏览器带着大 Cookie 的头部
+    string block;
+    for (int i = 0; i < 8; i++) {
+        block += "Cookie: " + string(600, 'c') + "\r\n";
+    }
+    block += "\r\n";
+    HttpScan::Level origin = HttpScan::GetLevel();
+    for (HttpScan::Level level : {HttpScan::SCALAR, HttpScan::SSE42, HttpScan::AVX2}) {
+        if (!HttpScan::SetLevel(level)) continue;
+        const int n = 100000;
+        size_t lines = 0;
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            const char* p = block.data();
+            const char* end = block.data() + block.size();
+            while (true) {
+                const char* lineEnd = HttpScan::FindCrlf(p, end);
+                if (lineEnd == end) break;
+                const char* colon = static_cast<const char*>(memchr(p, ':', lineEnd - p));
+                if (colon) HttpScan::FindCrOrLf(colon + 1, lineEnd);
+                lines++;
+                p = lineEnd + 2;
+            }
+        }
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        cout << HttpScan::GetLevelName() << ": " << ns / n << " ns per " << block.size()
+             << " byte header block (" << lines / n << " lines)" << endl;
+    }
+    HttpScan::SetLevel(origin);
+}
+
+// 原来基于 std::regex 的解析, 只用来做对比测试
+static HttpRequest::HTTP_CODE RegexParse(Buffer& buff, unordered_map<string, string>& header) {
+    static const char CRLF[] = "\r\n";
+    bool requestLine = true;
+    while (true) {
+        const char* lineEnd = search(buff.peek(), static_cast<const char*>(buff.beginWrite()), CRLF, CRLF + 2);
+        if (lineEnd == buff.beginWrite()) return HttpRequest::NO_REQUEST;
+        string line(buff.peek(), lineEnd);
+        buff.retrieve(line.length() + 2);
+        smatch subMatch;
+        if (requestLine) {
+            regex pattern("^([a-zA-Z]+) ([^ ]+) HTTP/([^ ]+)$");
+            if (!regex_match(line, subMatch, pattern)) return HttpRequest::BAD_REQUEST;
+            requestLine = false;
+        } else if (line.empty()) {
+            return HttpRequest::GET_REQUEST;
+        } else {
+            regex patten("^([^:]*): ?(.*)$");
+            if (!regex_match(line, subMatch, patten)) return HttpRequest::BAD_REQUEST;
+            header[subMatch[1]] = subMatch[2];
+        }
+    }
+}
+
+void BenchHttpParse() {
+    cout << "=================Benchmark HttpRequest parse=================" << endl;
+    const string text("GET /css/bootstrap.min.css HTTP/1.1\r\n"
+                      "Host: 127.0.0.1:1316\r\n"
+                      "Connection: keep-alive\r\n"
+                      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+                      "Accept: text/css,*/*;q=0.1\r\n"
+                      "Referer: http://127.0.0.1:1316/\r\n"
+                      "Accept-Encoding: gzip, deflate, br\r\n"
+                      "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+                      "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+                      "\r\n");
+    const int n = 100000;
+    Buffer buff;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        unordered_map<string, string> header;
+        buff.append(text);
+        assert(RegexParse(buff, header) == HttpRequest::GET_REQUEST);
+    }
+    auto regexNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count() / n;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        HttpRequest req;
+        buff.append(text);
+        assert(req.parse(buff) == HttpRequest::GET_REQUEST);
+    }
+    auto parserNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count() / n;
+    cout << "regex: " << regexNs << " ns/request, hand-written: " << parserNs << " ns/request" << endl;
 }
 
 void TestHttpResponse() {
@@ -313,18 +1111,535 @@ void TestHttpResponse() {
         cout << respContent << endl;
         
     }
+    {
+        // 条件请求: 带上次的 ETag 或 Last-Modified 时返回 304, 不带响应体
+        char* srcDir = getcwd(nullptr, 256);
+        strncat(srcDir, "/resources", 16);
+        auto respond = [srcDir](const string& headers, HttpResponse& resp) {
+            HttpRequest req;
+            Buffer in, out;
+            in.append("GET /js/custom.js HTTP/1.1\r\n" + headers + "\r\n");
+            assert(req.parse(in) == HttpRequest::GET_REQUEST);
+            resp.init(srcDir, req.path(), true, 200);
+            resp.makeResponse(out, &req);
+            return out.retrieveAllToString();
+        };
+        auto header = [](const string& resp, const string& name) {
+            size_t pos = resp.find("\r\n" + name + ": ");
+            if (pos == string::npos) return string();
+            pos += name.size() + 4;
+            return resp.substr(pos, resp.find("\r\n", pos) - pos);
+        };
+        HttpResponse resp;
+        string first = respond("", resp);
+        string etag = header(first, "ETag"), lastModified = header(first, "Last-Modified");
+        assert(resp.code() == 200 && resp.file() && etag.size() > 2 && !lastModified.empty());
+        assert(header(first, "Cache-Control") == "public, max-age=86400");
+
+        string again = respond("If-None-Match: \"x\", W/" + etag + "\r\n", resp);
+        assert(resp.code() == 304 && !resp.file() && resp.fileLen() == 0);
+        assert(again.find("HTTP/1.1 304 Not Modified\r\n") == 0);
+        assert(header(again, "ETag") == etag && header(again, "Content-length").empty());
+        assert(again.substr(again.size() - 4) == "\r\n\r\n");
+
+        respond("If-Modified-Since: " + lastModified + "\r\n", resp);
+        assert(resp.code() == 304);
+        respond("If-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n", resp);
+        assert(resp.code() == 200);
+        // If-None-Match 优先
+        respond("If-None-Match: \"x\"\r\nIf-Modified-Since: " + lastModified + "\r\n", resp);
+        assert(resp.code() == 200);
+        respond("If-Modified-Since: garbage\r\n", resp);
+        assert(resp.code() == 200);
+
+        // 完整的 200 响应用缓存在文件上的响应头, 内容和逐项生成的一致, 只有 Date 是当前时间
+        FileCache::Instance()->clear();
+        string built = respond("", resp);
+        string cached = respond("", resp);
+        auto withoutDate = [](string resp) {
+            size_t pos = resp.find("\r\nDate: ");
+            return resp.erase(pos, resp.find("\r\n", pos + 2) - pos);
+        };
+        assert(withoutDate(built) == withoutDate(cached));
+        assert(header(cached, "Date").size() == HttpHeader::DATE_LEN);
+        assert(header(cached, "Connection") == "keep-alive" && header(cached, "ETag") == etag);
+        assert(stoul(header(cached, "Content-length")) == resp.fileLen());
+        assert(resp.parts().size() == 1 && resp.parts()[0].textLen == cached.size());
+        HttpRequest req;
+        Buffer in, out;
+        in.append("GET /js/custom.js HTTP/1.0\r\n\r\n");
+        assert(req.parse(in) == HttpRequest::GET_REQUEST);
+        resp.init(srcDir, req.path(), req.isKeepAlive(), 200);
+        resp.makeResponse(out, &req);
+        string closed = out.retrieveAllToString();
+        assert(header(closed, "Connection") == "close" && header(closed, "ETag") == etag);
+        free(srcDir);
+    }
+    {
+        // 错误页面在内存里只有一份, 磁盘上的页面之后再变化也不影响
+        char* srcDir = getcwd(nullptr, 256);
+        strncat(srcDir, "/resources", 16);
+        HttpResponse::LoadErrorPages(srcDir);
+        auto page = [srcDir](int code) {
+            ifstream in(string(srcDir) + "/" + to_string(code) + ".html", ios::binary);
+            return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        };
+        HttpResponse first, second;
+        Buffer buff;
+        first.init(srcDir, "/nothing", true, 200);
+        first.makeResponse(buff);
+        string head = buff.retrieveAllToString();
+        assert(first.code() == 404 && head.find("HTTP/1.1 404 Not Found\r\n") == 0);
+        assert(head.find("Connection: keep-alive\r\n") != string::npos);
+        assert(string(first.file(), first.fileLen()) == page(404));
+        second.init(srcDir, "/nothing/again", false, 200);
+        second.makeResponse(buff);
+        head = buff.retrieveAllToString();
+        assert(second.file() == first.file() && head.find("Connection: close\r\n") != string::npos);
+
+        second.init(srcDir, "/index.html", true, 405);
+        second.makeResponse(buff);
+        head = buff.retrieveAllToString();
+        assert(head.find("HTTP/1.1 405 Method Not Allowed\r\n") == 0);
+        assert(head.find("\r\nAllow: GET, POST\r\n") != string::npos);
+        assert(head.find("Content-length: " + to_string(page(405).size()) + "\r\n\r\n") != string::npos);
+        assert(string(second.file(), second.fileLen()) == page(405));
+        assert(second.parts().size() == 1 && second.parts()[0].textLen == head.size());
+        free(srcDir);
+    }
 }
 
 void TestHttpConn() {
     cout << "=================Testing HttpConn=================" << endl;
     {
+        // 流水线: 一次读入多个请求, 响应按顺序一起写出, 半个请求留到下次
+        char* srcDir = getcwd(nullptr, 256);
+        strncat(srcDir, "/resources", 16);
+        HttpConn::srcDir = srcDir;
+        HttpConn::isET = true;
+        int sv[2];
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != -1);
         HttpConn conn;
-        int p[2];
-        assert(pipe(p) != -1);
+        conn.init(sv[0], sockaddr_in{});
+        string reqs;
+        for (int i = 0; i < HttpConn::MAX_PIPELINE + 2; i++) {
+            reqs += "GET /index HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+        }
+        reqs += "GET /nothing HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+        reqs += "PUT /index HTTP/1.1\r\nConnection: keep-alive\r\nContent-Length: 2\r\n\r\nab";
+        reqs += "GET /login HTTP/1.1\r\n";
+        assert(write(sv[1], reqs.data(), reqs.size()) == static_cast<ssize_t>(reqs.size()));
+        int err = 0;
+        fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+        fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+        conn.read(&err);
+
+        string out;
+        char buf[65536];
+        auto drain = [&] {
+            while (conn.toWriteBytes() > 0) {
+                conn.write(&err);
+                ssize_t n;
+                while ((n = read(sv[1], buf, sizeof(buf))) > 0) out.append(buf, n);
+            }
+        };
+        auto count = [](const string& s, const string& word) {
+            int n = 0;
+            for (size_t pos = s.find(word); pos != string::npos; pos = s.find(word, pos + 1)) n++;
+            return n;
+        };
+        assert(conn.process());
+        drain();
+        assert(count(out, "HTTP/1.1 200 OK") == HttpConn::MAX_PIPELINE);
+        assert(conn.isKeepAlive());
+        assert(conn.process());
+        drain();
+        assert(count(out, "HTTP/1.1 200 OK") == HttpConn::MAX_PIPELINE + 2);
+        assert(count(out, "HTTP/1.1 404 Not Found") == 1);
+        assert(count(out, "HTTP/1.1 405 Method Not Allowed") == 1);
+        assert(out.rfind("HTTP/1.1 405") > out.rfind("HTTP/1.1 404"));
+        assert(out.rfind("HTTP/1.1 404") > out.rfind("HTTP/1.1 200"));
+        // 最后半个请求还没读完
+        assert(!conn.process());
+        string rest = "Connection: close\r\n\r\n";
+        assert(write(sv[1], rest.data(), rest.size()) == static_cast<ssize_t>(rest.size()));
+        conn.read(&err);
+        assert(conn.process());
+        drain();
+        assert(count(out, "HTTP/1.1 ") == HttpConn::MAX_PIPELINE + 5);
+        assert(!conn.isKeepAlive());
+        cout << "responses: " << count(out, "HTTP/1.1 ") << ", bytes: " << out.size() << endl;
+        conn.close();
+        close(sv[1]);
+        free(srcDir);
+    }
+    {
+        // 登录请求停在连接上等数据库结果, 前面的响应先发出去, 后面的请求等结果填回来后按顺序处理
+        char* srcDir = getcwd(nullptr, 256);
+        strncat(srcDir, "/resources", 16);
+        HttpConn::srcDir = srcDir;
+        HttpConn::isET = true;
+        int sv[2];
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != -1);
+        fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+        fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+        HttpConn conn;
+        conn.init(sv[0], sockaddr_in{});
+        string body = "username=abc&password=123";
+        string reqs = "GET /index HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+        reqs += "POST /login HTTP/1.1\r\nConnection: keep-alive\r\n"
+                "Content-Type: application/x-www-form-urlencoded\r\n"
+                "Content-Length: " + to_string(body.size()) + "\r\n\r\n" + body;
+        reqs += "GET /index HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+        assert(write(sv[1], reqs.data(), reqs.size()) == static_cast<ssize_t>(reqs.size()));
+        int err = 0;
+        conn.read(&err);
+        // 读入了还没处理的请求, 过载时也不拒绝
+        assert(!conn.idle());
+
+        string out;
+        char buf[65536];
+        auto drain = [&] {
+            while (conn.toWriteBytes() > 0) {
+                conn.write(&err);
+                ssize_t n;
+                while ((n = read(sv[1], buf, sizeof(buf))) > 0) out.append(buf, n);
+            }
+        };
+        assert(!conn.waitingVerify());
+        assert(conn.process());
+        // 有响应没写完时不交出去
+        assert(!conn.waitingVerify());
+        drain();
+        assert(out.find("HTTP/1.1 200 OK") != string::npos);
+        size_t first = out.size();
+        assert(!conn.process());
+        assert(conn.waitingVerify());
+        assert(conn.request().getPost("username") == "abc");
+        assert(conn.request().getPost("password") == "123");
+        assert(conn.request().isLogin());
+        // 还没有结果, 再 process 也不会越过它
+        assert(!conn.process());
+        assert(conn.waitingVerify());
+        assert(!conn.idle());
+        conn.verifyDone(false);
+        assert(!conn.waitingVerify());
+        assert(conn.process());
+        drain();
+        string rest = out.substr(first);
+        size_t second = rest.find("HTTP/1.1 200 OK", 1);
+        assert(rest.find("HTTP/1.1 200 OK") == 0 && second != string::npos);
+        // 验证失败返回 error.html, 后面的 GET 跟在它后面
+        FileRef errorPage = FileCache::Instance()->get(string(srcDir) + "/error.html");
+        assert(errorPage);
+        assert(rest.find(string(errorPage->data, errorPage->size)) < second);
+        assert(!conn.process());
+        assert(!conn.waitingVerify());
+        assert(conn.idle());
+        // 只收到半个请求头
+        const char half[] = "GET /index HTTP/1.1\r\nConnection: kee";
+        assert(write(sv[1], half, sizeof(half) - 1) == static_cast<ssize_t>(sizeof(half) - 1));
+        conn.read(&err);
+        assert(!conn.process());
+        assert(!conn.idle());
+        conn.close();
+        close(sv[1]);
+        free(srcDir);
+    }
+    {
+        // 超过阈值的文件走 sendfile, 和 writev 的响应交错时顺序和内容不变
+        char* srcDir = getcwd(nullptr, 256);
+        strncat(srcDir, "/resources", 16);
+        HttpConn::srcDir = srcDir;
         HttpConn::isET = true;
-        // TODO: TEST
+        FileCache::Instance()->clear();
+        FileCache::Instance()->setSendfileThreshold(1024);
+        int sv[2];
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != -1);
+        fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+        fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+        HttpConn conn;
+        conn.init(sv[0], sockaddr_in{});
+        string reqs;
+        const char* paths[] = { "/js/jquery.js", "/nothing", "/index.html", "/js/custom.js", "/css/animate.css" };
+        for (const char* path : paths) {
+            reqs += string("GET ") + path + " HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+        }
+        assert(write(sv[1], reqs.data(), reqs.size()) == static_cast<ssize_t>(reqs.size()));
+        int err = 0;
+        conn.read(&err);
+        assert(conn.process());
+        string out;
+        char buf[65536];
+        while (conn.toWriteBytes() > 0) {
+            conn.write(&err);
+            ssize_t n;
+            while ((n = read(sv[1], buf, sizeof(buf))) > 0) out.append(buf, n);
+        }
+        // 按 Content-length 切出每个响应体, 和磁盘上的文件比较
+        size_t pos = 0;
+        for (const char* path : paths) {
+            size_t headerEnd = out.find("\r\n\r\n", pos);
+            size_t lenPos = out.find("Content-length: ", pos);
+            assert(headerEnd != string::npos && lenPos < headerEnd);
+            size_t len = stoul(out.substr(lenPos + 16));
+            string body = out.substr(headerEnd + 4, len);
+            string file = string(srcDir) + (strcmp(path, "/nothing") == 0 ? "/404.html" : path);
+            ifstream in(file, ios::binary);
+            string expected((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+            assert(body == expected);
+            pos = headerEnd + 4 + len;
+        }
+        assert(pos == out.size());
+        cout << "sendfile mixed responses: " << out.size() << " bytes" << endl;
+        FileCache::Instance()->setSendfileThreshold(FileCache::DEFAULT_SENDFILE_THRESHOLD);
+        FileCache::Instance()->clear();
+        conn.close();
+        close(sv[1]);
+        free(srcDir);
     }
+    {
+        // Range: 单段、后缀、多段、无法满足和 If-Range 不匹配, 映射和 sendfile 两条路径结果相同
+        char* srcDir = getcwd(nullptr, 256);
+        strncat(srcDir, "/resources", 16);
+        HttpConn::srcDir = srcDir;
+        HttpConn::isET = true;
+        string path = string(srcDir) + "/js/jquery.js";
+        ifstream in(path, ios::binary);
+        string file((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        size_t size = file.size();
+        auto header = [](const string& resp, const string& name) {
+            size_t pos = resp.find("\r\n" + name + ": ");
+            if (pos == string::npos) return string();
+            pos += name.size() + 4;
+            return resp.substr(pos, resp.find("\r\n", pos) - pos);
+        };
+        for (size_t threshold : { FileCache::DEFAULT_SENDFILE_THRESHOLD, (size_t)1024 }) {
+            FileCache::Instance()->clear();
+            FileCache::Instance()->setSendfileThreshold(threshold);
+            int sv[2];
+            assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != -1);
+            fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+            fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+            HttpConn conn;
+            conn.init(sv[0], sockaddr_in{});
+            int err = 0;
+            auto request = [&](const string& headers) {
+                string req = "GET /js/jquery.js HTTP/1.1\r\nConnection: keep-alive\r\n" + headers + "\r\n";
+                assert(write(sv[1], req.data(), req.size()) == static_cast<ssize_t>(req.size()));
+                conn.read(&err);
+                assert(conn.process());
+                string out;
+                char buf[65536];
+                while (conn.toWriteBytes() > 0) {
+                    conn.write(&err);
+                    ssize_t n;
+                    while ((n = read(sv[1], buf, sizeof(buf))) > 0) out.append(buf, n);
+                }
+                return out;
+            };
+            auto body = [](const string& resp) { return resp.substr(resp.find("\r\n\r\n") + 4); };
+
+            string full = request("");
+            assert(full.find("HTTP/1.1 200 OK\r\n") == 0 && header(full, "Accept-Ranges") == "bytes");
+            assert(body(full) == file);
+            string etag = header(full, "ETag");
+
+            string single = request("Range: bytes=100-199\r\n");
+            assert(single.find("HTTP/1.1 206 Partial Content\r\n") == 0);
+            assert(header(single, "Content-Range") == "bytes 100-199/" + to_string(size));
+            assert(header(single, "Content-length") == "100" && body(single) == file.substr(100, 100));
+
+            string suffix = request("Range: bytes=-10\r\nIf-Range: " + etag + "\r\n");
+            assert(suffix.find("HTTP/1.1 206") == 0 && body(suffix) == file.substr(size - 10));
+            string open = request("Range: bytes=" + to_string(size - 5) + "-\r\n");
+            assert(body(open) == file.substr(size - 5));
 
+            // 多段: 按 boundary 切开后逐段比较
+            string multi = request("Range: bytes=0-9, 2000-2999, -5\r\n");
+            string type = header(multi, "Content-type");
+            assert(multi.find("HTTP/1.1 206") == 0 && type.find("multipart/byteranges; boundary=") == 0);
+            string boundary = "--" + type.substr(type.find('=') + 1);
+            string all = body(multi);
+            assert(all.size() == stoul(header(multi, "Content-length")));
+            vector<pair<size_t, size_t>> expected = { {0, 10}, {2000, 1000}, {size - 5, 5} };
+            size_t pos = 0;
+            for (auto& [offset, len] : expected) {
+                pos = all.find("\r\n" + boundary + "\r\n", pos);
+                assert(pos != string::npos);
+                size_t partEnd = all.find("\r\n\r\n", pos + 2);
+                string partHeader = all.substr(pos, partEnd + 2 - pos);
+                assert(header(partHeader, "Content-Range") == "bytes " + to_string(offset) + "-"
+                       + to_string(offset + len - 1) + "/" + to_string(size));
+                assert(all.substr(partEnd + 4, len) == file.substr(offset, len));
+                pos = partEnd + 4 + len;
+            }
+            assert(all.substr(pos) == "\r\n" + boundary + "--\r\n");
+
+            string unsatisfiable = request("Range: bytes=" + to_string(size) + "-\r\n");
+            assert(unsatisfiable.find("HTTP/1.1 416 Range Not Satisfiable\r\n") == 0);
+            assert(header(unsatisfiable, "Content-Range") == "bytes */" + to_string(size));
+            assert(body(unsatisfiable).empty());
+
+            // If-Range 不匹配、格式错误时发送整个文件
+            string stale = request("Range: bytes=0-9\r\nIf-Range: \"stale\"\r\n");
+            assert(stale.find("HTTP/1.1 200") == 0 && body(stale) == file);
+            string bad = request("Range: bytes=9-0\r\n");
+            assert(bad.find("HTTP/1.1 200") == 0 && body(bad) == file);
+            string unit = request("Range: items=0-9\r\n");
+            assert(unit.find("HTTP/1.1 200") == 0);
+            conn.close();
+            close(sv[1]);
+        }
+        cout << "range responses ok, file size: " << size << endl;
+        FileCache::Instance()->setSendfileThreshold(FileCache::DEFAULT_SENDFILE_THRESHOLD);
+        FileCache::Instance()->clear();
+        free(srcDir);
+    }
+}
+
+void TestFileCache() {
+    cout << "=================Testing FileCache=================" << endl;
+    {
+        FileCache* cache = FileCache::Instance();
+        cache->clear();
+        cache->setCapacity(FileCache::DEFAULT_CAPACITY);
+        char dir[] = "/tmp/filecacheXXXXXX";
+        assert(mkdtemp(dir));
+        auto writeFile = [&dir](const string& name, const string& content) {
+            // 先写临时文件再 rename, 和部署静态文件的方式一致, 不改动已经映射的 inode
+            string path = string(dir) + "/" + name;
+            string tmp = path + ".tmp";
+            FILE* fp = fopen(tmp.c_str(), "w");
+            fwrite(content.data(), 1, content.size(), fp);
+            fclose(fp);
+            chmod(tmp.c_str(), 0644);
+            rename(tmp.c_str(), path.c_str());
+            return path;
+        };
+        string a = writeFile("a.css", string(1000, 'a'));
+        string b = writeFile("b.js", "bbb");
+        FileCache::Stats before = cache->getStats();
+
+        // 第一次未命中, 之后命中同一份映射
+        FileRef fa = cache->get(a);
+        assert(fa && fa->size == 1000 && fa->data[999] == 'a');
+        for (int i = 0; i < 10; i++) {
+            assert(cache->get(a) == fa);
+        }
+        FileCache::Stats stats = cache->getStats();
+        assert(stats.misses - before.misses == 1);
+        assert(stats.hits - before.hits == 10);
+
+        // 不存在和没有权限
+        int err = 0;
+        assert(!cache->get(string(dir) + "/none", &err) && err == ENOENT);
+        assert(!cache->get(dir, &err) && err == ENOENT);
+        chmod(b.c_str(), 0600);
+        assert(!cache->get(b, &err) && err == EACCES);
+        chmod(b.c_str(), 0644);
+
+        // 容量缩小时淘汰, 已经拿到的引用不受影响
+        FileRef fb = cache->get(b);
+        cache->setCapacity(0);
+        assert(cache->getStats().files == 0);
+        assert(cache->getStats().evictions - before.evictions >= 1);
+        assert(fa->data[0] == 'a' && string(fb->data, fb->size) == "bbb");
+        cache->setCapacity(FileCache::DEFAULT_CAPACITY);
+
+        // 文件修改后, 过了重新检查的间隔会重新映射
+        FileRef old = cache->get(b);
+        writeFile("b.js", "changed");
+        std::this_thread::sleep_for(chrono::milliseconds(FileCache::REVALIDATE_MS + 50));
+        FileRef now = cache->get(b);
+        assert(now != old && string(now->data, now->size) == "changed");
+        assert(string(old->data, old->size) == "bbb");
+
+        // 不存在的结果只在要求时缓存
+        before = cache->getStats();
+        string missing = string(dir) + "/c.js.gz";
+        assert(!cache->get(missing, &err, true) && err == ENOENT);
+        err = 0;
+        assert(!cache->get(missing, &err, true) && err == ENOENT);
+        assert(cache->getStats().hits - before.hits == 1);
+        assert(!cache->get(string(dir) + "/d.js", &err));
+        assert(!cache->get(string(dir) + "/d.js", &err));
+        assert(cache->getStats().misses - before.misses == 3);
+
+        // 多线程同时读
+        vector<thread> threads;
+        atomic<int> bad(0);
+        for (int t = 0; t < 8; t++) {
+            threads.emplace_back([&] {
+                for (int i = 0; i < 10000; i++) {
+                    FileRef f = cache->get(i % 2 ? a : b);
+                    if (!f || f->size == 0) bad++;
+                }
+            });
+        }
+        for (thread& t : threads) t.join();
+        assert(bad == 0);
+        stats = cache->getStats();
+        cout << "hits: " << stats.hits << ", misses: " << stats.misses << ", evictions: " << stats.evictions
+             << ", files: " << stats.files << ", bytes: " << stats.bytes << endl;
+        cache->clear();
+        unlink(a.c_str());
+        unlink(b.c_str());
+        rmdir(dir);
+    }
+}
+
+void TestConnTable() {
+    cout << "=================Testing ConnTable=================" << endl;
+    {
+        ConnTable table(16);
+        sockaddr_in addr = {0};
+        int p[2];
+        assert(pipe(p) != -1);
+        assert(table.get(p[0]) == nullptr);
+        HttpConn* conn = table.acquire(p[0], addr);
+        uint32_t generation = conn->getGeneration();
+        assert(table.get(p[0]) == conn);
+        assert(table.get(p[0], generation) == conn);
+        // 同一块里没用过的槽位
+        assert(table.get(p[1]) == nullptr);
+        conn->close();
+        // 同一个 fd 被新连接复用, 槽位地址不变, 旧的 generation 失效
+        assert(pipe(p) != -1);
+        HttpConn* reused = table.acquire(p[0], addr);
+        assert(reused == conn);
+        assert(table.get(p[0], generation) == nullptr);
+        assert(table.get(p[0], reused->getGeneration()) == reused);
+        assert(table.get(16) == nullptr && table.get(-1) == nullptr);
+        reused->close();
+        close(p[1]);
+    }
+    {
+        // 任务提交时连接还在, 执行前连接已经关闭(槽位还没被复用), 按旧的 fd + generation 找不到连接
+        ConnTable table(16);
+        sockaddr_in addr = {0};
+        int p[2];
+        assert(pipe(p) != -1);
+        HttpConn* conn = table.acquire(p[0], addr);
+        int fd = conn->getFd();
+        uint32_t generation = conn->getGeneration();
+        atomic<bool> closed = false;
+        atomic<int> handled = 0, dropped = 0;
+        {
+            ThreadPool pool(1);
+            pool.AddTask([&, fd, generation] {
+                while (!closed) std::this_thread::yield();
+                if (table.get(fd, generation)) handled++;
+                else dropped++;
+            });
+            conn->close();
+            closed = true;
+        }
+        assert(handled == 0 && dropped == 1);
+        assert(table.get(fd) == conn && conn->isClosed());
+        assert(conn->getGeneration() != generation);
+        close(p[1]);
+    }
 }
 
 int setFdNonblock(int fd) {
@@ -453,16 +1768,25 @@ void TestConnect() {
 
 int main() {
     // TestThreadPool();
+    // BenchThreadPool();
     // TestSqlPool();
     // TestHeapTimer();
+    // TestTimeWheel();
+    // BenchTimer();
     // TestBlockingQueue();
     // TestBuffer();
     // TestAsyncLog();
     // TestSyncLog();
     // TestHttpRequestGetLine();
     // TestHttpRequestParse();
+    // BenchHttpParse();
+    // TestHttpScan();
+    // BenchHttpScan();
     // TestHttpResponse();
+    // TestHttpConn();
     // TestEpoller();
+    // TestConnTable();
+    // TestFileCache();
     TestConnect();
     this_thread::sleep_for(chrono::milliseconds(500));
     cout << "TEST FINISHED\n";